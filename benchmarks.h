@@ -0,0 +1,360 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include "clusteredLighting.h"
+#include "frustumCulling.h"
+#include "model.h"
+#include "objParser.h"
+#include "renderQueue.h"
+#include "sceneGraph.h"
+#include "shader_s.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Micro benchmarks that can be started from the ImGui window. They run on a worker thread and report through a
+// BenchmarkLog, which the UI shows and which is also echoed to the console.
+class BenchmarkLog
+{
+public:
+    void add(const std::string& line)
+    {
+        std::cout << line << std::endl;
+        std::lock_guard<std::mutex> lock(mutex);
+        lines.push_back(line);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lines.clear();
+    }
+
+    std::vector<std::string> snapshot() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lines;
+    }
+
+    std::atomic<bool> running{ false };
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::string> lines;
+};
+
+// imports each OBJ with the native parser and with Assimp (same post-processing as Model) and compares the throughput.
+// Each import runs a few times and the fastest run counts, so the file is in the page cache for both.
+inline void benchmarkObjParser(const std::vector<std::string>& paths, ThreadPool& pool, BenchmarkLog& log)
+{
+    const int RUNS = 3;
+    char line[256];
+    for (const std::string& path : paths)
+    {
+        std::error_code error;
+        double megabytes = std::filesystem::file_size(path, error) / (1024.0 * 1024.0);
+        if (error)
+        {
+            log.add("ERROR::BENCHMARK:: could not read " + path);
+            continue;
+        }
+
+        double parserMs = 1e30, assimpMs = 1e30;
+        size_t parserTriangles = 0, assimpTriangles = 0;
+        for (int run = 0; run < RUNS; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<MeshData> meshes;
+            bool parsed = parseObj(path, meshes, &pool);
+            parserMs = std::min(parserMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            if (!parsed)
+            {
+                parserMs = 0.0;
+                break;
+            }
+            parserTriangles = 0;
+            for (const MeshData& mesh : meshes)
+                parserTriangles += mesh.indices.size() / 3;
+        }
+        for (int run = 0; run < RUNS; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(path, MODEL_POST_PROCESS_FLAGS);
+            assimpMs = std::min(assimpMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            if (!scene)
+            {
+                assimpMs = 0.0;
+                break;
+            }
+            assimpTriangles = 0;
+            for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+                assimpTriangles += scene->mMeshes[i]->mNumFaces;
+        }
+
+        log.add(path);
+        if (parserMs > 0.0)
+        {
+            snprintf(line, sizeof(line), "  OBJ parser %7.2f ms %7.1f MB/s (%zu triangles)", parserMs, megabytes * 1000.0 / parserMs, parserTriangles);
+            log.add(line);
+        }
+        else
+            log.add("  OBJ parser rejected the file");
+        if (assimpMs > 0.0)
+        {
+            snprintf(line, sizeof(line), "  Assimp     %7.2f ms %7.1f MB/s (%zu triangles)", assimpMs, megabytes * 1000.0 / assimpMs, assimpTriangles);
+            log.add(line);
+        }
+        if (parserMs > 0.0 && assimpMs > 0.0)
+        {
+            snprintf(line, sizeof(line), "  %.1fx faster, %.2f MB, %u threads", assimpMs / parserMs, megabytes, pool.size() + 1);
+            log.add(line);
+        }
+    }
+}
+// CPU cost of setting a vec3 uniform: the old glGetUniformLocation-with-std::string path against the hashed table,
+// a precomputed handle, and the value filter. The shader must be in use and have a localColor uniform. Runs on the GL thread.
+inline void benchmarkUniforms(Shader& shader, BenchmarkLog& log)
+{
+    const int ITERATIONS = 100000;
+    constexpr UniformId LOCAL_COLOR("localColor");
+    char line[256];
+    auto measure = [&](const char* label, auto&& body)
+    {
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ITERATIONS; i++)
+            body(i);
+        glFinish();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+        snprintf(line, sizeof(line), "  %-22s %7.1f ns/set", label, ns);
+        log.add(line);
+    };
+
+    if (shader.uniform(LOCAL_COLOR).entry < 0)
+    {
+        log.add("ERROR::BENCHMARK:: the current model shader doesn't use localColor");
+        return;
+    }
+    log.add("Uniform setters (localColor)");
+    measure("string lookup", [&](int i)
+    {
+        // what setVec3(const std::string&, ...) used to do for a literal
+        glm::vec3 value(float(i), 0.0f, 0.0f);
+        glUniform3fv(glGetUniformLocation(shader.ID, std::string("localColor").c_str()), 1, glm::value_ptr(value));
+    });
+    shader.invalidateUniformCache();
+    measure("hashed name", [&](int i) { shader.setVec3(LOCAL_COLOR, glm::vec3(float(i), 0.0f, 0.0f)); });
+    Shader::Uniform handle = shader.uniform(LOCAL_COLOR);
+    measure("handle", [&](int i) { shader.set(handle, glm::vec3(float(i), 0.0f, 0.0f)); });
+    measure("handle, unchanged value", [&](int) { shader.set(handle, glm::vec3(1.0f, 0.0f, 0.0f)); });
+    shader.invalidateUniformCache();
+}
+
+// sorting a frame's draw keys with RenderQueue's radix sort against std::sort, for scenes of growing size. The keys
+// look like a real queue's: a few programs, a few hundred materials and VAOs, random depths.
+inline void benchmarkRenderQueueSort(BenchmarkLog& log)
+{
+    const int RUNS = 5;
+    char line[256];
+    log.add("Render queue sort (best of 5)");
+    for (size_t count : { size_t(1000), size_t(10000), size_t(100000) })
+    {
+        std::vector<RenderQueue::SortKey> keys(count), sorted, scratch;
+        uint64_t state = 0x9E3779B97F4A7C15ull;
+        for (size_t i = 0; i < count; i++)
+        {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            uint64_t random = state >> 16;
+            keys[i].key = (uint64_t(random % 4) << 52) | (uint64_t((random >> 2) % 300) << 36) | (uint64_t((random >> 11) % 200) << 24) | ((random >> 19) & 0xFFFFFF);
+            keys[i].item = static_cast<uint32_t>(i);
+        }
+        double radixMs = 1e9, stdMs = 1e9;
+        for (int run = 0; run < RUNS; run++)
+        {
+            sorted = keys;
+            auto start = std::chrono::steady_clock::now();
+            RenderQueue::radixSort(sorted, scratch);
+            radixMs = std::min(radixMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+            sorted = keys;
+            start = std::chrono::steady_clock::now();
+            std::stable_sort(sorted.begin(), sorted.end(), [](const RenderQueue::SortKey& a, const RenderQueue::SortKey& b) { return a.key < b.key; });
+            stdMs = std::min(stdMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        snprintf(line, sizeof(line), "  %6zu draws: radix %.3f ms, std::stable_sort %.3f ms", count, radixMs, stdMs);
+        log.add(line);
+    }
+}
+
+// culling 100k object boxes scattered around the camera against its frustum, one box at a time and with the SIMD path
+// cull() takes. Single threaded, so the rates are per core.
+inline void benchmarkFrustumCulling(BenchmarkLog& log)
+{
+    const size_t COUNT = 100000;
+    const int RUNS = 5;
+    char line[256];
+    CullingSet boxes;
+    boxes.resize(COUNT);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto random = [&state]
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return (state >> 40) / float(1 << 24);
+    };
+    for (size_t i = 0; i < COUNT; i++)
+    {
+        glm::vec3 center(random() * 200.0f - 100.0f, random() * 20.0f - 10.0f, random() * 200.0f - 100.0f);
+        boxes.set(i, center, glm::vec3(0.2f + random(), 0.2f + random(), 0.2f + random()));
+    }
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f) * view);
+
+    std::vector<uint32_t> visible, visibleScalar;
+    visible.reserve(COUNT);
+    visibleScalar.reserve(COUNT);
+    double simdMs = 1e9, scalarMs = 1e9;
+    for (int run = 0; run < RUNS; run++)
+    {
+        visible.clear();
+        auto start = std::chrono::steady_clock::now();
+        boxes.cull(frustum, visible);
+        simdMs = std::min(simdMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        visibleScalar.clear();
+        start = std::chrono::steady_clock::now();
+        boxes.cullScalar(frustum, visibleScalar);
+        scalarMs = std::min(scalarMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    log.add("Frustum culling, 100k boxes (best of 5, one core)");
+    snprintf(line, sizeof(line), "  scalar %7.3f ms %7.1f M boxes/s", scalarMs, COUNT / scalarMs / 1000.0);
+    log.add(line);
+    snprintf(line, sizeof(line), "  %-6s %7.3f ms %7.1f M boxes/s", CullingSet::simdName(), simdMs, COUNT / simdMs / 1000.0);
+    log.add(line);
+    snprintf(line, sizeof(line), "  %zu visible, %s", visible.size(), visible == visibleScalar ? "both paths agree" : "ERROR: the paths disagree");
+    log.add(line);
+}
+
+// updating the world matrices of a 100k node scene graph after everything moved, after a few objects moved and after
+// nothing moved. The graph is 1000 objects of 100 nodes, each node parented to an earlier node of its object.
+inline void benchmarkSceneGraph(BenchmarkLog& log)
+{
+    const int OBJECTS = 1000;
+    const int NODES_PER_OBJECT = 100;
+    const int RUNS = 5;
+    char line[256];
+    SceneGraph graph;
+    graph.reserve(OBJECTS * NODES_PER_OBJECT);
+    std::vector<int> roots;
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (int object = 0; object < OBJECTS; object++)
+    {
+        int root = graph.add(SceneGraph::NO_PARENT, glm::vec3(float(object % 32), 0.0f, float(object / 32)));
+        roots.push_back(root);
+        for (int node = 1; node < NODES_PER_OBJECT; node++)
+        {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            int parent = root + static_cast<int>((state >> 33) % node);
+            graph.add(parent, glm::vec3(0.0f, 0.1f, 0.0f), glm::angleAxis(0.1f * node, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(0.95f));
+        }
+    }
+    graph.update();
+
+    auto measure = [&](const char* label, auto&& move)
+    {
+        double bestMs = 1e9;
+        size_t recomputed = 0;
+        for (int run = 0; run < RUNS; run++)
+        {
+            move(run);
+            auto start = std::chrono::steady_clock::now();
+            recomputed = graph.update();
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        snprintf(line, sizeof(line), "  %-16s %8.3f ms %7zu matrices %7.1f M nodes/s", label, bestMs, recomputed, graph.size() / bestMs / 1000.0);
+        log.add(line);
+    };
+    log.add("Scene graph update, 100k nodes (best of 5)");
+    measure("all moved", [&](int run)
+    {
+        for (size_t node = 0; node < graph.size(); node++)
+            graph.setRotation(static_cast<int>(node), glm::angleAxis(0.01f * run, glm::vec3(0.0f, 1.0f, 0.0f)));
+    });
+    measure("10 objects moved", [&](int run)
+    {
+        for (int object = 0; object < 10; object++)
+            graph.setPosition(roots[object * (OBJECTS / 10)], glm::vec3(float(run), 0.0f, float(object)));
+    });
+    measure("nothing moved", [](int) {});
+}
+
+// binning 64, 1024 and 4096 point lights into the cluster grid of a 1920x1080 view: the scalar and SIMD box tests on
+// one core and the SIMD test across the pool, with the stages of the pooled build. The grid doesn't depend on the
+// resolution, only the tiles per pixel do, so this is the CPU side of the clustered pass at 1080p.
+inline void benchmarkLightClusters(ThreadPool& pool, BenchmarkLog& log)
+{
+    const int COUNTS[] = { 64, 1024, 4096 };
+    const int RUNS = 5;
+    char line[256];
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto random = [&state]
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return (state >> 40) / float(1 << 24);
+    };
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1920.0f / 1080.0f, 0.1f, 100.0f);
+
+    LightClusters clusters, reference;
+    log.add("Light clusters, 16x9x24 grid at 1920x1080 (best of 5)");
+    for (int count : COUNTS)
+    {
+        std::vector<PointLight> lights(count);
+        for (PointLight& light : lights)
+        {
+            light.position = glm::vec3(random() * 40.0f - 20.0f, random() * 6.0f - 1.0f, -1.0f - random() * 40.0f);
+            light.radius = 0.5f + random() * 1.5f;
+            light.color = glm::vec3(random(), random(), random());
+        }
+        double scalarMs = 1e9, simdMs = 1e9, pooledMs = 1e9;
+        LightClusters::Timings stages;
+        for (int run = 0; run < RUNS; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            reference.build(lights, view, projection, nullptr, false);
+            scalarMs = std::min(scalarMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+            start = std::chrono::steady_clock::now();
+            clusters.build(lights, view, projection);
+            simdMs = std::min(simdMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+            start = std::chrono::steady_clock::now();
+            clusters.build(lights, view, projection, &pool);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (ms < pooledMs)
+            {
+                pooledMs = ms;
+                stages = clusters.timings();
+            }
+        }
+        bool agree = clusters.clusterRanges() == reference.clusterRanges() && clusters.clusterIndices() == reference.clusterIndices();
+        snprintf(line, sizeof(line), "  %4d lights: scalar %6.3f ms, %s %6.3f ms, %s %u threads %6.3f ms", count, scalarMs, LightClusters::simdName(), simdMs,
+            LightClusters::simdName(), pool.size() + 1u, pooledMs);
+        log.add(line);
+        snprintf(line, sizeof(line), "    setup %.3f, bin %.3f, compact %.3f ms; %zu indices, %.1f per cluster, max %u, %s", stages.setupMs, stages.binMs, stages.compactMs,
+            clusters.indexCount(), clusters.indexCount() / float(LightClusters::CLUSTER_COUNT), clusters.maxClusterLights(), agree ? "paths agree" : "ERROR: the paths disagree");
+        log.add(line);
+    }
+}
+#endif
@@ -0,0 +1,68 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// axis-aligned box and bounding sphere of some geometry in its own space. The sphere is centered on the box, its
+// radius reaches the farthest point, which is tighter than the box's half diagonal.
+struct Bounds
+{
+    glm::vec3 minimum = glm::vec3(0.0f);
+    glm::vec3 maximum = glm::vec3(0.0f);
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+
+    glm::vec3 extent() const { return (maximum - minimum) * 0.5f; }
+};
+
+// the position of point i in a vertex array, stride bytes apart
+inline const glm::vec3& stridedPosition(const glm::vec3* positions, size_t stride, size_t i)
+{
+    return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(positions) + i * stride);
+}
+
+// distance from center to the farthest of count points
+inline float farthestDistance(const glm::vec3& center, const glm::vec3* positions, size_t count, size_t stride = sizeof(glm::vec3))
+{
+    float distanceSquared = 0.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 offset = stridedPosition(positions, stride, i) - center;
+        distanceSquared = std::max(distanceSquared, glm::dot(offset, offset));
+    }
+    return std::sqrt(distanceSquared);
+}
+
+// bounds of count points, e.g. the positions of a vertex array with stride sizeof(Vertex). Empty input gives a point at the origin.
+inline Bounds computeBounds(const glm::vec3* positions, size_t count, size_t stride = sizeof(glm::vec3))
+{
+    Bounds bounds;
+    if (count == 0)
+        return bounds;
+    bounds.minimum = bounds.maximum = stridedPosition(positions, stride, 0);
+    for (size_t i = 1; i < count; i++)
+    {
+        const glm::vec3& position = stridedPosition(positions, stride, i);
+        bounds.minimum = glm::min(bounds.minimum, position);
+        bounds.maximum = glm::max(bounds.maximum, position);
+    }
+    bounds.center = (bounds.minimum + bounds.maximum) * 0.5f;
+    bounds.radius = farthestDistance(bounds.center, positions, count, stride);
+    return bounds;
+}
+
+// world space box around the local box under transform: the center is transformed, the extent along each world axis is
+// the sum of the absolute projections of the local extents (Arvo's method)
+inline void transformBounds(const Bounds& bounds, const glm::mat4& transform, glm::vec3& center, glm::vec3& extent)
+{
+    glm::vec3 localExtent = bounds.extent();
+    center = glm::vec3(transform * glm::vec4((bounds.minimum + bounds.maximum) * 0.5f, 1.0f));
+    extent = glm::abs(glm::vec3(transform[0])) * localExtent.x
+        + glm::abs(glm::vec3(transform[1])) * localExtent.y
+        + glm::abs(glm::vec3(transform[2])) * localExtent.z;
+}
+#endif
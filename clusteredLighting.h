@@ -0,0 +1,436 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "glState.h"
+#include "shader_s.h"
+#include "threadPool.h"
+#include "uniformBlocks.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// the widest instruction set the build targets, like frustumCulling.h; /arch:AVX (-mavx) enables the 8-wide path
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CLUSTERED_LIGHTING_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLUSTERED_LIGHTING_SSE
+#endif
+
+// a point light of the clustered pass, uploaded as is: two RGBA32F texels per light
+struct PointLight
+{
+    glm::vec3 position; // world space
+    float radius;       // the light fades out to nothing here, see clusterLightAttenuation in clusteredLights.glsl
+    glm::vec3 color;
+    float padding0;
+};
+static_assert(sizeof(PointLight) == 32, "PointLight is uploaded as is");
+
+// Point lights binned into a grid of view space clusters: TILES_X by TILES_Y screen tiles, each cut into SLICES depth
+// slices that grow exponentially from the near to the far plane. A fragment finds its cluster from its pixel and view
+// depth and shades only the lights whose sphere touches that cluster (clusteredLights.glsl).
+//
+// build() runs on the CPU without GL calls. Each light goes into the list of every depth slice its sphere spans and
+// gets the tile rows its sphere crosses from the planes between the rows. Then the slices are binned in parallel, one
+// slice per job so no two jobs write the same cluster: in each of its rows a light is tested against the boxes of the
+// row's 16 clusters at once with SIMD. The per-slice lists are concatenated at the end. upload() streams the lights,
+// the (first index, count) pair of every cluster and the light indices into three texture buffers, bind() puts them on
+// their fixed units (SharedTextureUnit in shader_s.h).
+class LightClusters
+{
+public:
+    static const int TILES_X = 16;
+    static const int TILES_Y = 9;
+    static const int SLICES = 24;
+    static const int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+    static constexpr size_t MAX_LIGHTS = 65536; // indices are 16 bit
+
+    // CPU time of the stages of the last build() and upload()
+    struct Timings
+    {
+        float setupMs = 0.0f;   // lights to view space and into their depth slices
+        float binMs = 0.0f;     // sphere against cluster tests
+        float compactMs = 0.0f; // the slices' lists into one
+        float uploadMs = 0.0f;
+    };
+
+    LightClusters() {}
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    void create()
+    {
+        const GLenum formats[BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+        const SharedTextureUnit units[BUFFER_COUNT] = { TEXTURE_UNIT_CLUSTER_LIGHTS, TEXTURE_UNIT_CLUSTER_RANGES, TEXTURE_UNIT_CLUSTER_INDICES };
+        glGenBuffers(BUFFER_COUNT, buffers);
+        glGenTextures(BUFFER_COUNT, textures);
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            // some storage from the start, so the textures are complete before the first upload
+            capacities[i] = 16;
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, capacities[i], nullptr, GL_STREAM_DRAW);
+            GlState::get().bindTexture(units[i], GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void release()
+    {
+        glDeleteTextures(BUFFER_COUNT, textures);
+        glDeleteBuffers(BUFFER_COUNT, buffers);
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            textures[i] = buffers[i] = 0;
+            capacities[i] = 0;
+        }
+    }
+
+    // bins lights for a camera. The projection has to be a symmetric perspective like glm::perspective; the grid is
+    // rebuilt when it changes. With a pool the slices are binned on its workers and the calling thread. simd = false
+    // takes the scalar test, for the benchmark.
+    void build(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection, ThreadPool* pool = nullptr, bool simd = true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!gridValid || projection != gridProjection)
+            buildGrid(projection);
+        count = std::min(lights.size(), MAX_LIGHTS);
+        lightData.assign(lights.begin(), lights.begin() + count);
+        viewLights.resize(count);
+        for (SliceBins& slice : slices)
+            slice.lights.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            ViewLight& light = viewLights[i];
+            light.center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            light.radius = lights[i].radius;
+            float depth = -light.center.z;
+            if (depth + light.radius <= nearPlane || depth - light.radius >= farPlane)
+                continue;
+            // a row lies between two planes through the eye, the sphere crosses it unless it is wholly above or below
+            float distances[TILES_Y + 1];
+            for (int plane = 0; plane <= TILES_Y; plane++)
+                distances[plane] = (light.center.y + rowPlanes[plane].x * light.center.z) * rowPlanes[plane].y;
+            light.rows = 0;
+            for (int y = 0; y < TILES_Y; y++)
+                if (distances[y] >= -light.radius && distances[y + 1] <= light.radius)
+                    light.rows |= 1u << y;
+            if (light.rows == 0)
+                continue;
+            int first = sliceOf(depth - light.radius);
+            int last = sliceOf(depth + light.radius);
+            for (int slice = first; slice <= last; slice++)
+                slices[slice].lights.push_back(static_cast<uint16_t>(i));
+        }
+        auto binStart = std::chrono::steady_clock::now();
+
+        if (pool)
+            pool->parallelFor(SLICES, [this, simd](size_t slice) { binSlice(static_cast<int>(slice), simd); });
+        else
+            for (int slice = 0; slice < SLICES; slice++)
+                binSlice(slice, simd);
+        auto compactStart = std::chrono::steady_clock::now();
+
+        size_t total = 0;
+        for (const SliceBins& slice : slices)
+            total += slice.indices.size();
+        indexData.resize(total);
+        maxLights = 0;
+        uint32_t offset = 0;
+        for (int slice = 0; slice < SLICES; slice++)
+        {
+            std::copy(slices[slice].indices.begin(), slices[slice].indices.end(), indexData.begin() + offset);
+            for (int cluster = slice * TILES_X * TILES_Y; cluster < (slice + 1) * TILES_X * TILES_Y; cluster++)
+            {
+                ranges[2 * cluster] += offset;
+                maxLights = std::max(maxLights, ranges[2 * cluster + 1]);
+            }
+            offset += static_cast<uint32_t>(slices[slice].indices.size());
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        timing.setupMs = std::chrono::duration<float, std::milli>(binStart - start).count();
+        timing.binMs = std::chrono::duration<float, std::milli>(compactStart - binStart).count();
+        timing.compactMs = std::chrono::duration<float, std::milli>(end - compactStart).count();
+    }
+
+    // no lights, the shaders skip the clustered loop
+    void clear()
+    {
+        count = 0;
+        lightData.clear();
+        indexData.clear();
+        maxLights = 0;
+    }
+
+    // streams what build() made to the texture buffers, GL thread only
+    void upload()
+    {
+        auto start = std::chrono::steady_clock::now();
+        uploadBuffer(0, lightData.data(), lightData.size() * sizeof(PointLight));
+        uploadBuffer(1, ranges.data(), ranges.size() * sizeof(uint32_t));
+        uploadBuffer(2, indexData.data(), indexData.size() * sizeof(uint16_t));
+        timing.uploadMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // binds the texture buffers to their units, once per frame before the lit passes
+    void bind() const
+    {
+        GlState::get().bindTexture(TEXTURE_UNIT_CLUSTER_LIGHTS, GL_TEXTURE_BUFFER, textures[0]);
+        GlState::get().bindTexture(TEXTURE_UNIT_CLUSTER_RANGES, GL_TEXTURE_BUFFER, textures[1]);
+        GlState::get().bindTexture(TEXTURE_UNIT_CLUSTER_INDICES, GL_TEXTURE_BUFFER, textures[2]);
+    }
+
+    // the Clusters block for a viewport of this size
+    ClusterBlock block(float viewportWidth, float viewportHeight) const
+    {
+        ClusterBlock block;
+        block.grid = glm::ivec4(TILES_X, TILES_Y, SLICES, static_cast<int>(count));
+        block.scale = glm::vec4(TILES_X / viewportWidth, TILES_Y / viewportHeight, sliceScale, sliceBias);
+        return block;
+    }
+
+    size_t lightCount() const { return count; }
+    size_t indexCount() const { return indexData.size(); }
+    uint32_t maxClusterLights() const { return maxLights; }
+    const Timings& timings() const { return timing; }
+
+    // the binning result, for comparing the paths in the benchmark
+    const std::vector<uint32_t>& clusterRanges() const { return ranges; }
+    const std::vector<uint16_t>& clusterIndices() const { return indexData; }
+
+    // name of the path the box tests take, for the UI and benchmarks
+    static const char* simdName()
+    {
+#if defined(CLUSTERED_LIGHTING_AVX)
+        return "AVX";
+#elif defined(CLUSTERED_LIGHTING_SSE)
+        return "SSE";
+#else
+        return "scalar";
+#endif
+    }
+
+private:
+    static const int BUFFER_COUNT = 3; // lights, ranges, indices
+    static_assert(TILES_X % 8 == 0 && TILES_X <= 32 && TILES_Y <= 32, "a row of clusters is a whole number of SIMD registers, rows and columns fit 32 bit masks");
+
+    struct ViewLight
+    {
+        glm::vec3 center; // view space
+        float radius;
+        uint32_t rows;    // a bit for every tile row the sphere crosses
+    };
+
+    // the lights that reach a depth slice and the lists of its clusters, written by one job only
+    struct SliceBins
+    {
+        std::vector<uint16_t> lights;
+        std::vector<uint16_t> indices;
+        std::vector<uint16_t> rowLights; // the lights that touch clusters of the current row
+        std::vector<uint32_t> rowMasks;  // and the clusters of the row they touch, a bit per cluster
+    };
+
+    // view space cluster boxes, one array per component so a register loads a component of consecutive clusters
+    std::vector<float> minimumX, minimumY, minimumZ, maximumX, maximumY, maximumZ;
+    glm::vec2 rowPlanes[TILES_Y + 1]; // the plane y = x * depth between two rows, and 1 / the length of its normal
+    glm::mat4 gridProjection = glm::mat4(1.0f);
+    bool gridValid = false;
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    float sliceScale = 0.0f, sliceBias = 0.0f; // slice = log(depth) * sliceScale + sliceBias
+    float sliceDepths[SLICES + 1] = {};        // view depth where each slice starts, and the far plane
+
+    size_t count = 0;
+    std::vector<PointLight> lightData;
+    std::vector<ViewLight> viewLights;
+    SliceBins slices[SLICES];
+    std::vector<uint32_t> ranges = std::vector<uint32_t>(2 * CLUSTER_COUNT, 0); // first index and count per cluster
+    std::vector<uint16_t> indexData;
+    uint32_t maxLights = 0;
+    Timings timing;
+
+    GLuint buffers[BUFFER_COUNT] = {};
+    GLuint textures[BUFFER_COUNT] = {};
+    size_t capacities[BUFFER_COUNT] = {};
+
+    // the slice whose boxes hold depth. The log picks it, the slice bounds settle rounding at the edges, so a light
+    // goes into exactly the slices its depth range overlaps.
+    int sliceOf(float depth) const
+    {
+        if (depth <= nearPlane)
+            return 0;
+        int slice = std::min(std::max(static_cast<int>(std::floor(std::log(depth) * sliceScale + sliceBias)), 0), SLICES - 1);
+        if (slice > 0 && depth < sliceDepths[slice])
+            slice--;
+        else if (slice < SLICES - 1 && depth >= sliceDepths[slice + 1])
+            slice++;
+        return slice;
+    }
+
+    // the view space box of every cluster. At view depth d a tile from ndc x0 to x1 spans x0 * d / P[0][0] to
+    // x1 * d / P[0][0], the box holds the tile at the slice's near and far depth. The planes between the rows go
+    // through the eye and the ndc y of the row edges.
+    void buildGrid(const glm::mat4& projection)
+    {
+        gridProjection = projection;
+        gridValid = true;
+        nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+        sliceScale = SLICES / std::log(farPlane / nearPlane);
+        sliceBias = -std::log(nearPlane) * sliceScale;
+
+        for (std::vector<float>* component : { &minimumX, &minimumY, &minimumZ, &maximumX, &maximumY, &maximumZ })
+            component->resize(CLUSTER_COUNT);
+        for (int plane = 0; plane <= TILES_Y; plane++)
+        {
+            float slope = (-1.0f + 2.0f * plane / TILES_Y) / projection[1][1];
+            rowPlanes[plane] = glm::vec2(slope, 1.0f / std::sqrt(1.0f + slope * slope));
+        }
+        for (int slice = 0; slice <= SLICES; slice++)
+            sliceDepths[slice] = nearPlane * std::pow(farPlane / nearPlane, float(slice) / SLICES);
+        for (int slice = 0; slice < SLICES; slice++)
+        {
+            float depths[2] = { sliceDepths[slice], sliceDepths[slice + 1] };
+            for (int y = 0; y < TILES_Y; y++)
+            {
+                int row = slice * TILES_Y + y;
+                for (int x = 0; x < TILES_X; x++)
+                {
+                    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+                    for (float depth : depths)
+                    {
+                        for (int corner = 0; corner < 4; corner++)
+                        {
+                            float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / TILES_X;
+                            float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / TILES_Y;
+                            glm::vec3 point(ndcX * depth / projection[0][0], ndcY * depth / projection[1][1], -depth);
+                            minimum = glm::min(minimum, point);
+                            maximum = glm::max(maximum, point);
+                        }
+                    }
+                    int cluster = row * TILES_X + x;
+                    minimumX[cluster] = minimum.x;
+                    minimumY[cluster] = minimum.y;
+                    minimumZ[cluster] = minimum.z;
+                    maximumX[cluster] = maximum.x;
+                    maximumY[cluster] = maximum.y;
+                    maximumZ[cluster] = maximum.z;
+                }
+            }
+        }
+    }
+
+    // the cluster lists of one slice, in the order the shaders index them: x fastest, then y. The ranges start at the
+    // slice's own list, build() moves them to the combined one.
+    void binSlice(int slice, bool simd)
+    {
+        SliceBins& bins = slices[slice];
+        bins.indices.clear();
+        for (int y = 0; y < TILES_Y; y++)
+        {
+            int row = slice * TILES_Y + y;
+            bins.rowLights.clear();
+            bins.rowMasks.clear();
+            for (uint16_t light : bins.lights)
+            {
+                const ViewLight& sphere = viewLights[light];
+                if (!(sphere.rows & (1u << y)))
+                    continue;
+                uint32_t mask = simd ? rowMask(row, sphere) : rowMaskScalar(row, sphere);
+                if (mask == 0)
+                    continue;
+                bins.rowLights.push_back(light);
+                bins.rowMasks.push_back(mask);
+            }
+            for (int x = 0; x < TILES_X; x++)
+            {
+                int cluster = row * TILES_X + x;
+                uint32_t first = static_cast<uint32_t>(bins.indices.size());
+                for (size_t i = 0; i < bins.rowLights.size(); i++)
+                    if (bins.rowMasks[i] & (1u << x))
+                        bins.indices.push_back(bins.rowLights[i]);
+                ranges[2 * cluster] = first;
+                ranges[2 * cluster + 1] = static_cast<uint32_t>(bins.indices.size()) - first;
+            }
+        }
+    }
+
+    // a bit for every cluster of the row the sphere touches: the squared distance from the center to the box against
+    // the squared radius, 8 (AVX) or 4 (SSE) clusters at a time
+    uint32_t rowMask(int row, const ViewLight& sphere) const
+    {
+        uint32_t mask = 0;
+#if defined(CLUSTERED_LIGHTING_AVX)
+        __m256 cx = _mm256_set1_ps(sphere.center.x), cy = _mm256_set1_ps(sphere.center.y), cz = _mm256_set1_ps(sphere.center.z);
+        __m256 radiusSquared = _mm256_set1_ps(sphere.radius * sphere.radius);
+        __m256 zero = _mm256_setzero_ps();
+        for (int x = 0; x < TILES_X; x += 8)
+        {
+            size_t i = row * TILES_X + x;
+            __m256 dx = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minimumX[i]), cx), zero), _mm256_max_ps(_mm256_sub_ps(cx, _mm256_loadu_ps(&maximumX[i])), zero));
+            __m256 dy = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minimumY[i]), cy), zero), _mm256_max_ps(_mm256_sub_ps(cy, _mm256_loadu_ps(&maximumY[i])), zero));
+            __m256 dz = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minimumZ[i]), cz), zero), _mm256_max_ps(_mm256_sub_ps(cz, _mm256_loadu_ps(&maximumZ[i])), zero));
+            __m256 distanceSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(distanceSquared, radiusSquared, _CMP_LE_OQ))) << x;
+        }
+#elif defined(CLUSTERED_LIGHTING_SSE)
+        __m128 cx = _mm_set1_ps(sphere.center.x), cy = _mm_set1_ps(sphere.center.y), cz = _mm_set1_ps(sphere.center.z);
+        __m128 radiusSquared = _mm_set1_ps(sphere.radius * sphere.radius);
+        __m128 zero = _mm_setzero_ps();
+        for (int x = 0; x < TILES_X; x += 4)
+        {
+            size_t i = row * TILES_X + x;
+            __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minimumX[i]), cx), zero), _mm_max_ps(_mm_sub_ps(cx, _mm_loadu_ps(&maximumX[i])), zero));
+            __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minimumY[i]), cy), zero), _mm_max_ps(_mm_sub_ps(cy, _mm_loadu_ps(&maximumY[i])), zero));
+            __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minimumZ[i]), cz), zero), _mm_max_ps(_mm_sub_ps(cz, _mm_loadu_ps(&maximumZ[i])), zero));
+            __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(distanceSquared, radiusSquared))) << x;
+        }
+#else
+        mask = rowMaskScalar(row, sphere);
+#endif
+        return mask;
+    }
+
+    // the same one cluster at a time
+    uint32_t rowMaskScalar(int row, const ViewLight& sphere) const
+    {
+        uint32_t mask = 0;
+        float radiusSquared = sphere.radius * sphere.radius;
+        for (int x = 0; x < TILES_X; x++)
+        {
+            size_t i = row * TILES_X + x;
+            float dx = std::max(minimumX[i] - sphere.center.x, 0.0f) + std::max(sphere.center.x - maximumX[i], 0.0f);
+            float dy = std::max(minimumY[i] - sphere.center.y, 0.0f) + std::max(sphere.center.y - maximumY[i], 0.0f);
+            float dz = std::max(minimumZ[i] - sphere.center.z, 0.0f) + std::max(sphere.center.z - maximumZ[i], 0.0f);
+            if (dx * dx + dy * dy + dz * dz <= radiusSquared)
+                mask |= 1u << x;
+        }
+        return mask;
+    }
+
+    // grows with some room like InstanceBuffer and orphans the old storage, so draws still reading it don't stall
+    void uploadBuffer(int buffer, const void* data, size_t bytes)
+    {
+        if (bytes > capacities[buffer])
+            capacities[buffer] = bytes + bytes / 2;
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+        glBufferData(GL_TEXTURE_BUFFER, capacities[buffer], nullptr, GL_STREAM_DRAW);
+        if (bytes > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+#endif
@@ -0,0 +1,117 @@
+#ifndef DEFERRED_SHADING_H
+#define DEFERRED_SHADING_H
+
+#include <glad/glad.h>
+
+#include "glState.h"
+#include "shader_s.h"
+
+#include <cstddef>
+#include <iostream>
+
+// Render targets of the deferred path. The geometry pass (shaders/deferred/gBuffer.f) writes per pixel:
+//   albedo  RGBA8             base color, shininess in alpha as log2(shininess) / 8
+//   normal  RG16              world space normal, octahedral encoded into [0, 1]
+//   depth   DEPTH24_STENCIL8  the world position is rebuilt from it with the inverse view-projection
+// 12 bytes per pixel, packed by shaders/include/gBuffer.glsl. The lighting pass (shaders/deferred/lighting.f) reads
+// them from their fixed units (SharedTextureUnit in shader_s.h), walks the clustered lights of each pixel and writes
+// the lit color into the forward framebuffer, so the post-processing chain reads it from there as before. Geometry
+// that is not lit (the light sphere) is drawn forward afterwards, against the G-buffer depth copied by blitDepth().
+class GBuffer
+{
+public:
+    static const int BYTES_PER_PIXEL = 4 + 4 + 4;
+
+    GBuffer() {}
+
+    GBuffer(const GBuffer&) = delete;
+    GBuffer& operator=(const GBuffer&) = delete;
+
+    void create(int width, int height)
+    {
+        targetWidth = width;
+        targetHeight = height;
+        glGenFramebuffers(1, &framebuffer);
+        GlState::get().bindFramebuffer(framebuffer);
+        albedo = createTarget(TEXTURE_UNIT_GBUFFER_ALBEDO, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        normal = createTarget(TEXTURE_UNIT_GBUFFER_NORMAL, GL_RG16, GL_RG, GL_UNSIGNED_SHORT);
+        depth = createTarget(TEXTURE_UNIT_GBUFFER_DEPTH, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normal, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::GBUFFER:: Framebuffer is not complete!" << std::endl;
+        GlState::get().bindFramebuffer(0);
+    }
+
+    void release()
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        GLuint textures[] = { albedo, normal, depth };
+        glDeleteTextures(3, textures);
+        framebuffer = albedo = normal = depth = 0;
+    }
+
+    // binds the framebuffer for the geometry pass and clears its depth. The color targets keep last frame's values:
+    // the lighting pass skips every pixel the depth test left at the far plane, so they are never read there.
+    void begin() const
+    {
+        GlState::get().bindFramebuffer(framebuffer);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // binds the targets to their units for the lighting pass
+    void bindTextures() const
+    {
+        GlState::get().bindTexture(TEXTURE_UNIT_GBUFFER_ALBEDO, GL_TEXTURE_2D, albedo);
+        GlState::get().bindTexture(TEXTURE_UNIT_GBUFFER_NORMAL, GL_TEXTURE_2D, normal);
+        GlState::get().bindTexture(TEXTURE_UNIT_GBUFFER_DEPTH, GL_TEXTURE_2D, depth);
+    }
+
+    // copies the depth into target, whose depth attachment has to be DEPTH24_STENCIL8 of the same size. Leaves target
+    // bound.
+    void blitDepth(GLuint target) const
+    {
+        GlState::get().bindFramebuffer(target);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBlitFramebuffer(0, 0, targetWidth, targetHeight, 0, 0, targetWidth, targetHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+    }
+
+    int width() const { return targetWidth; }
+    int height() const { return targetHeight; }
+    size_t bytes() const { return static_cast<size_t>(targetWidth) * targetHeight * BYTES_PER_PIXEL; }
+
+    // the least memory traffic the G-buffer adds to a frame: every pixel written once by the geometry pass and read
+    // once by the lighting pass, and the depth read and written once by blitDepth(). Overdraw and framebuffer
+    // compression are not counted.
+    size_t frameTrafficBytes() const
+    {
+        return 2 * bytes() + static_cast<size_t>(targetWidth) * targetHeight * 4 * 2;
+    }
+
+private:
+    GLuint framebuffer = 0;
+    GLuint albedo = 0;
+    GLuint normal = 0;
+    GLuint depth = 0;
+    int targetWidth = 0;
+    int targetHeight = 0;
+
+    GLuint createTarget(SharedTextureUnit unit, GLint internalFormat, GLenum format, GLenum type)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GlState::get().bindTexture(unit, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, targetWidth, targetHeight, 0, format, type, NULL);
+        // read with texelFetch, one texel per pixel
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+};
+#endif
@@ -0,0 +1,176 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// the widest instruction set the build targets; there is no runtime dispatch, /arch:AVX (-mavx) enables the 8-wide path
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_CULLING_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_SSE
+#endif
+
+// the six clip planes of a view-projection matrix (Gribb and Hartmann). A point p is inside a plane when
+// dot(plane.xyz, p) + plane.w >= 0. The planes are not normalized, the box test only needs the sign.
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    Frustum() {}
+
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        glm::mat4 rows = glm::transpose(viewProjection);
+        planes[0] = rows[3] + rows[0]; // left
+        planes[1] = rows[3] - rows[0]; // right
+        planes[2] = rows[3] + rows[1]; // bottom
+        planes[3] = rows[3] - rows[1]; // top
+        planes[4] = rows[3] + rows[2]; // near
+        planes[5] = rows[3] - rows[2]; // far
+    }
+};
+
+// World space boxes of the objects in a scene, kept as one array per component (center x, y, z, extent x, y, z) so a
+// SIMD register loads the same component of 4 (SSE) or 8 (AVX) boxes at once and each plane is tested against all of
+// them with a few multiply-adds. set() may be called for different indices from several threads; cull() runs on one.
+class CullingSet
+{
+public:
+    void resize(size_t count)
+    {
+        for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+            component->resize(count);
+    }
+
+    size_t size() const { return centerX.size(); }
+
+    void set(size_t index, const glm::vec3& center, const glm::vec3& extent)
+    {
+        centerX[index] = center.x;
+        centerY[index] = center.y;
+        centerZ[index] = center.z;
+        extentX[index] = extent.x;
+        extentY[index] = extent.y;
+        extentZ[index] = extent.z;
+    }
+
+    // the box of local bounds placed by transform
+    void set(size_t index, const Bounds& bounds, const glm::mat4& transform)
+    {
+        glm::vec3 center, extent;
+        transformBounds(bounds, transform, center, extent);
+        set(index, center, extent);
+    }
+
+    // appends the indices of the boxes that are at least partly inside the frustum, in ascending order. Boxes that
+    // straddle a corner outside two planes are kept, like every plane-by-plane test.
+    void cull(const Frustum& frustum, std::vector<uint32_t>& visible) const
+    {
+        size_t count = size();
+        size_t i = 0;
+#if defined(FRUSTUM_CULLING_AVX)
+        __m256 planes[6][7];
+        for (int p = 0; p < 6; p++)
+            for (int c = 0; c < 7; c++)
+                planes[p][c] = _mm256_set1_ps(planeTerm(frustum.planes[p], c));
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < 6; p++)
+            {
+                // distance of the box corner farthest along the plane normal
+                __m256 distance = _mm256_add_ps(_mm256_mul_ps(planes[p][0], cx), planes[p][3]);
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(planes[p][1], cy));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(planes[p][2], cz));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(planes[p][4], ex));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(planes[p][5], ey));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(planes[p][6], ez));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+            appendMask(_mm256_movemask_ps(inside), i, visible);
+        }
+#elif defined(FRUSTUM_CULLING_SSE)
+        __m128 planes[6][7];
+        for (int p = 0; p < 6; p++)
+            for (int c = 0; c < 7; c++)
+                planes[p][c] = _mm_set1_ps(planeTerm(frustum.planes[p], c));
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; p++)
+            {
+                // distance of the box corner farthest along the plane normal
+                __m128 distance = _mm_add_ps(_mm_mul_ps(planes[p][0], cx), planes[p][3]);
+                distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][1], cy));
+                distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][2], cz));
+                distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][4], ex));
+                distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][5], ey));
+                distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][6], ez));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+            }
+            appendMask(_mm_movemask_ps(inside), i, visible);
+        }
+#endif
+        cullScalar(frustum, visible, i);
+    }
+
+    // the same test one box at a time, for the boxes from first on. Used for what doesn't fill a SIMD register.
+    void cullScalar(const Frustum& frustum, std::vector<uint32_t>& visible, size_t first = 0) const
+    {
+        for (size_t i = first; i < size(); i++)
+        {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++)
+            {
+                const glm::vec4& plane = frustum.planes[p];
+                float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w
+                    + std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+                inside = distance >= 0.0f;
+            }
+            if (inside)
+                visible.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    // name of the path cull() takes, for the UI and benchmarks
+    static const char* simdName()
+    {
+#if defined(FRUSTUM_CULLING_AVX)
+        return "AVX";
+#elif defined(FRUSTUM_CULLING_SSE)
+        return "SSE";
+#else
+        return "scalar";
+#endif
+    }
+
+private:
+    std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+
+    // the factors of the box test: normal x, y, z, distance, then the absolute normal for the extents
+    static float planeTerm(const glm::vec4& plane, int term)
+    {
+        return term < 4 ? plane[term] : std::abs(plane[term - 4]);
+    }
+
+    static void appendMask(int mask, size_t first, std::vector<uint32_t>& visible)
+    {
+        for (int bit = 0; mask != 0; bit++, mask >>= 1)
+            if (mask & 1)
+                visible.push_back(static_cast<uint32_t>(first + bit));
+    }
+};
+#endif
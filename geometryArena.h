@@ -0,0 +1,195 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include "glState.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// where a mesh lives inside a GeometryArena
+struct ArenaRange
+{
+    GLint baseVertex = 0;        // added to every index of the range by the draw
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+};
+
+// several ranges of one arena, submitted with a single glMultiDrawElementsBaseVertex. Built once, reused every frame.
+struct DrawBatch
+{
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+};
+
+// One vertex buffer, one index buffer and one VAO shared by many meshes of the same vertex layout. Meshes are appended on the
+// CPU with add(), then everything is uploaded at once; a draw only needs the range, so a whole model is one bind and one call.
+// Indices are stored relative to each mesh's first vertex, which keeps them 16-bit as long as no single mesh has more than
+// 65536 vertices. GL objects are freed by release(), not the destructor, since the owner may outlive the context.
+class GeometryArena
+{
+public:
+    // vertex size and the function that sets up the attribute pointers for it on the bound VAO/VBO
+    struct Layout
+    {
+        size_t stride;
+        void (*setAttributes)(GLsizei stride);
+    };
+
+    explicit GeometryArena(Layout layout) : layout(layout) {}
+
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    // appends an indexed mesh. Only valid before upload().
+    ArenaRange add(const void* vertexData, size_t vertexCount, const unsigned int* indexData, size_t indexCount)
+    {
+        ArenaRange range;
+        range.baseVertex = static_cast<GLint>(stagedVertexCount);
+        range.firstIndex = static_cast<unsigned int>(stagedIndices.size());
+        range.indexCount = static_cast<unsigned int>(indexCount);
+
+        const unsigned char* bytes = static_cast<const unsigned char*>(vertexData);
+        stagedVertices.insert(stagedVertices.end(), bytes, bytes + vertexCount * layout.stride);
+        stagedIndices.insert(stagedIndices.end(), indexData, indexData + indexCount);
+        stagedVertexCount += vertexCount;
+        if (vertexCount > 65536)
+            shortIndices = false;
+        return range;
+    }
+
+    // appends another index list for the vertices of an existing range (e.g. a LOD), sharing its base vertex
+    ArenaRange addIndices(const ArenaRange& vertices, const unsigned int* indexData, size_t indexCount)
+    {
+        ArenaRange range;
+        range.baseVertex = vertices.baseVertex;
+        range.firstIndex = static_cast<unsigned int>(stagedIndices.size());
+        range.indexCount = static_cast<unsigned int>(indexCount);
+        stagedIndices.insert(stagedIndices.end(), indexData, indexData + indexCount);
+        return range;
+    }
+
+    // appends a non-indexed triangle list, like the static arrays in main.cpp
+    ArenaRange add(const void* vertexData, size_t vertexCount)
+    {
+        std::vector<unsigned int> indices(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+            indices[i] = static_cast<unsigned int>(i);
+        return add(vertexData, vertexCount, indices.data(), indices.size());
+    }
+
+    // creates the GL buffers from everything added and drops the CPU copies. Must run on the GL thread.
+    void upload()
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        GlState::get().bindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, stagedVertices.size(), stagedVertices.data(), GL_STATIC_DRAW);
+        layout.setAttributes(static_cast<GLsizei>(layout.stride));
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        if (shortIndices)
+        {
+            std::vector<uint16_t> indices(stagedIndices.begin(), stagedIndices.end());
+            indexType = GL_UNSIGNED_SHORT;
+            indexBytes = indices.size() * sizeof(uint16_t);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices.data(), GL_STATIC_DRAW);
+        }
+        else
+        {
+            indexType = GL_UNSIGNED_INT;
+            indexBytes = stagedIndices.size() * sizeof(unsigned int);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, stagedIndices.data(), GL_STATIC_DRAW);
+        }
+        GlState::get().bindVertexArray(0);
+
+        vertexBytes = stagedVertices.size();
+        std::vector<unsigned char>().swap(stagedVertices);
+        std::vector<unsigned int>().swap(stagedIndices);
+    }
+
+    void release()
+    {
+        GlState::get().forgetVertexArray(VAO);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        VAO = VBO = EBO = 0;
+    }
+
+    void bind() const
+    {
+        GlState::get().bindVertexArray(VAO);
+    }
+
+    // attaches the arena's vertex and index buffers to the bound VAO, for VAOs that add attributes of their own
+    // (see InstanceBuffer). Only valid after upload().
+    void attachBuffers() const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        layout.setAttributes(static_cast<GLsizei>(layout.stride));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    }
+
+    // draws one range, the arena has to be bound
+    void draw(const ArenaRange& range) const
+    {
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, indexType, indexOffset(range), range.baseVertex);
+    }
+
+    // adds a range to a batch. Only valid after upload(), the offsets depend on the index type.
+    void addToBatch(DrawBatch& batch, const ArenaRange& range) const
+    {
+        batch.counts.push_back(static_cast<GLsizei>(range.indexCount));
+        batch.offsets.push_back(indexOffset(range));
+        batch.baseVertices.push_back(range.baseVertex);
+    }
+
+    // draws all ranges of a batch in one call, the arena has to be bound
+    void draw(const DrawBatch& batch) const
+    {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts.data(), indexType, batch.offsets.data(),
+            static_cast<GLsizei>(batch.counts.size()), batch.baseVertices.data());
+    }
+
+    // the same for instanced draws, a VAO with the arena's buffers has to be bound. GL 3.3 has no instanced
+    // multi-draw, so a batch is one call per range.
+    void drawInstanced(const ArenaRange& range, GLsizei instances) const
+    {
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, indexType, indexOffset(range), instances, range.baseVertex);
+    }
+
+    void drawInstanced(const DrawBatch& batch, GLsizei instances) const
+    {
+        for (size_t i = 0; i < batch.counts.size(); i++)
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, batch.counts[i], indexType, batch.offsets[i], instances, batch.baseVertices[i]);
+    }
+
+    size_t bytes() const { return vertexBytes + indexBytes; }
+    size_t vertexBufferBytes() const { return vertexBytes; }
+
+private:
+    Layout layout;
+    std::vector<unsigned char> stagedVertices;
+    std::vector<unsigned int> stagedIndices;
+    size_t stagedVertexCount = 0;
+    bool shortIndices = true;
+
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+
+    const void* indexOffset(const ArenaRange& range) const
+    {
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+        return reinterpret_cast<const void*>(size_t(range.firstIndex) * indexSize);
+    }
+};
+#endif
@@ -0,0 +1,183 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+// the kinds of calls GlState filters, for its counters
+enum GlStateCall
+{
+    STATE_CALL_PROGRAM,
+    STATE_CALL_VERTEX_ARRAY,
+    STATE_CALL_ACTIVE_TEXTURE,
+    STATE_CALL_TEXTURE,
+    STATE_CALL_FRAMEBUFFER,
+    STATE_CALL_ENABLE,
+    STATE_CALL_COUNT
+};
+
+// Shadow copy of the GL bindings the renderer changes the most: program, VAO, the active texture unit and the textures
+// bound to each unit, framebuffer, and a few enable bits. Calls that would set what is already set are dropped, so
+// callers can bind what they need without restoring defaults afterwards. Everything that changes these bindings has to
+// go through here, otherwise call invalidate() after it. Per-frame counts of issued and dropped calls are kept for the
+// UI. GL thread only.
+class GlState
+{
+public:
+    static const int MAX_TEXTURE_UNITS = 16;
+
+    static GlState& get()
+    {
+        static GlState state;
+        return state;
+    }
+
+    GlState(const GlState&) = delete;
+    GlState& operator=(const GlState&) = delete;
+
+    void useProgram(GLuint program)
+    {
+        if (filter(STATE_CALL_PROGRAM, currentProgram, program))
+            glUseProgram(program);
+    }
+
+    void bindVertexArray(GLuint vertexArray)
+    {
+        if (filter(STATE_CALL_VERTEX_ARRAY, currentVertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // binds texture to unit, switching the active unit only if needed. GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP are
+    // tracked, other targets are always bound.
+    void bindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        int slot = target == GL_TEXTURE_2D ? 0 : target == GL_TEXTURE_CUBE_MAP ? 1 : -1;
+        if (unit < MAX_TEXTURE_UNITS && slot >= 0 && !filter(STATE_CALL_TEXTURE, textures[unit][slot], texture))
+            return;
+        if (slot < 0 || unit >= MAX_TEXTURE_UNITS)
+            issued[STATE_CALL_TEXTURE]++;
+        activeTexture(unit);
+        glBindTexture(target, texture);
+    }
+
+    // GL_FRAMEBUFFER, i.e. both the draw and the read framebuffer
+    void bindFramebuffer(GLuint framebuffer)
+    {
+        if (filter(STATE_CALL_FRAMEBUFFER, currentFramebuffer, framebuffer))
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+
+    // glEnable/glDisable. GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST and GL_STENCIL_TEST are tracked,
+    // other capabilities are always set.
+    void setEnabled(GLenum capability, bool enabled)
+    {
+        int index = capabilityIndex(capability);
+        if (index >= 0 && !filter(STATE_CALL_ENABLE, capabilities[index], enabled ? 1u : 0u))
+            return;
+        if (index < 0)
+            issued[STATE_CALL_ENABLE]++;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    // the program in use, 0 if unknown
+    GLuint program() const { return currentProgram == UNKNOWN ? 0 : currentProgram; }
+
+    // call when deleting objects: GL unbinds them, and a new object may get the same name
+    void forgetProgram(GLuint program)
+    {
+        if (currentProgram == program)
+            currentProgram = UNKNOWN;
+    }
+
+    void forgetVertexArray(GLuint vertexArray)
+    {
+        if (currentVertexArray == vertexArray)
+            currentVertexArray = UNKNOWN;
+    }
+
+    void forgetTexture(GLuint texture)
+    {
+        for (GLuint(&unit)[2] : textures)
+            for (GLuint& bound : unit)
+                if (bound == texture)
+                    bound = UNKNOWN;
+    }
+
+    // forgets everything, the next call of each kind is issued. Needed after state was changed behind our back.
+    void invalidate()
+    {
+        currentProgram = currentVertexArray = currentActiveTexture = currentFramebuffer = UNKNOWN;
+        for (GLuint(&unit)[2] : textures)
+            unit[0] = unit[1] = UNKNOWN;
+        for (GLuint& capability : capabilities)
+            capability = UNKNOWN;
+    }
+
+    // starts counting a new frame; issuedCount/elidedCount then report the frame that just ended
+    void beginFrame()
+    {
+        for (int i = 0; i < STATE_CALL_COUNT; i++)
+        {
+            lastIssued[i] = issued[i];
+            lastElided[i] = elided[i];
+            issued[i] = elided[i] = 0;
+        }
+    }
+
+    int issuedCount(GlStateCall call) const { return lastIssued[call]; }
+    int elidedCount(GlStateCall call) const { return lastElided[call]; }
+
+    static const char* callName(GlStateCall call)
+    {
+        static const char* names[STATE_CALL_COUNT] = { "Program", "VAO", "Unit", "Texture", "FBO", "Enable" };
+        return names[call];
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+    static constexpr GLenum TRACKED_CAPABILITIES[] = { GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST, GL_STENCIL_TEST };
+    static const int CAPABILITY_COUNT = sizeof(TRACKED_CAPABILITIES) / sizeof(TRACKED_CAPABILITIES[0]);
+
+    GLuint currentProgram = UNKNOWN;
+    GLuint currentVertexArray = UNKNOWN;
+    GLuint currentActiveTexture = UNKNOWN;
+    GLuint currentFramebuffer = UNKNOWN;
+    GLuint textures[MAX_TEXTURE_UNITS][2]; // 2D and cube map binding of each unit
+    GLuint capabilities[CAPABILITY_COUNT];
+    int issued[STATE_CALL_COUNT] = {};
+    int elided[STATE_CALL_COUNT] = {};
+    int lastIssued[STATE_CALL_COUNT] = {};
+    int lastElided[STATE_CALL_COUNT] = {};
+
+    GlState() { invalidate(); }
+
+    // true if the call has to be made, and remembers the new value
+    bool filter(GlStateCall call, GLuint& current, GLuint value)
+    {
+        if (current == value)
+        {
+            elided[call]++;
+            return false;
+        }
+        current = value;
+        issued[call]++;
+        return true;
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if (filter(STATE_CALL_ACTIVE_TEXTURE, currentActiveTexture, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    static int capabilityIndex(GLenum capability)
+    {
+        for (int i = 0; i < CAPABILITY_COUNT; i++)
+            if (TRACKED_CAPABILITIES[i] == capability)
+                return i;
+        return -1;
+    }
+};
+#endif
@@ -0,0 +1,154 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// GPU time of named render passes, measured with GL_TIME_ELAPSED queries. Every pass has a small ring of query objects
+// so this frame's queries never have to wait for the GPU: results are read back a few frames later, and only once the
+// driver reports them available. The last HISTORY samples of each pass are kept for averages and percentiles.
+// GL_TIME_ELAPSED queries can't nest, so passes have to follow each other.
+class GpuProfiler
+{
+public:
+    static const int LATENCY = 3;   // frames in flight before a result is read
+    static const int HISTORY = 240;  // samples per pass for the statistics
+
+    GpuProfiler() {}
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    // registers a pass and returns its index for begin(). Must run on the GL thread.
+    int addPass(const std::string& name)
+    {
+        Pass pass;
+        pass.name = name;
+        glGenQueries(LATENCY, pass.queries);
+        passes.push_back(pass);
+        return static_cast<int>(passes.size()) - 1;
+    }
+
+    void release()
+    {
+        for (Pass& pass : passes)
+            glDeleteQueries(LATENCY, pass.queries);
+        passes.clear();
+    }
+
+    // collects the results that have arrived since the last frame and moves on to the next set of queries
+    void beginFrame()
+    {
+        frame++;
+        int slot = frame % LATENCY;
+        for (Pass& pass : passes)
+        {
+            // the slot about to be reused was issued LATENCY frames ago, its result is usually there by now
+            if (!pass.pending[slot])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                pass.skipped[slot] = true; // don't wait, this pass gets no new query this frame
+                continue;
+            }
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &nanoseconds);
+            pass.pending[slot] = false;
+            pass.skipped[slot] = false;
+            addSample(pass, nanoseconds / 1000000.0f);
+        }
+    }
+
+    void begin(int pass)
+    {
+        int slot = frame % LATENCY;
+        Pass& p = passes[pass];
+        if (!enabled || p.skipped[slot])
+            return;
+        glBeginQuery(GL_TIME_ELAPSED, p.queries[slot]);
+        p.pending[slot] = true;
+        active = pass;
+    }
+
+    void end()
+    {
+        if (active < 0)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        active = -1;
+    }
+
+    int passCount() const { return static_cast<int>(passes.size()); }
+    const std::string& passName(int pass) const { return passes[pass].name; }
+    int sampleCount(int pass) const { return passes[pass].sampleCount; }
+
+    float averageMs(int pass) const
+    {
+        const Pass& p = passes[pass];
+        if (p.sampleCount == 0)
+            return 0.0f;
+        float sum = 0.0f;
+        for (int i = 0; i < p.sampleCount; i++)
+            sum += p.samples[i];
+        return sum / p.sampleCount;
+    }
+
+    // the time that the given fraction (0..1) of the recent frames stayed under, e.g. 0.99 for the 99th percentile
+    float percentileMs(int pass, float fraction) const
+    {
+        const Pass& p = passes[pass];
+        if (p.sampleCount == 0)
+            return 0.0f;
+        std::vector<float> sorted(p.samples, p.samples + p.sampleCount);
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+    // sum of the pass averages
+    float totalMs() const
+    {
+        float total = 0.0f;
+        for (int i = 0; i < passCount(); i++)
+            total += averageMs(i);
+        return total;
+    }
+
+    // drops the collected samples, e.g. before measuring a new configuration. Queries already issued still arrive.
+    void reset()
+    {
+        for (Pass& pass : passes)
+            pass.sampleCount = pass.nextSample = 0;
+    }
+
+    bool enabled = true;
+
+private:
+    struct Pass
+    {
+        std::string name;
+        GLuint queries[LATENCY] = {};
+        bool pending[LATENCY] = {}; // issued and not read back yet
+        bool skipped[LATENCY] = {}; // still pending when its slot came around again
+        float samples[HISTORY] = {};
+        int sampleCount = 0;
+        int nextSample = 0;
+    };
+    std::vector<Pass> passes;
+    unsigned int frame = 0;
+    int active = -1;
+
+    static void addSample(Pass& pass, float ms)
+    {
+        pass.samples[pass.nextSample] = ms;
+        pass.nextSample = (pass.nextSample + 1) % HISTORY;
+        if (pass.sampleCount < HISTORY)
+            pass.sampleCount++;
+    }
+};
+#endif
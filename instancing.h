@@ -0,0 +1,132 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "geometryArena.h"
+#include "glState.h"
+#include "normalMatrix.h"
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+// per-instance vertex attributes, read by shaders built with INSTANCED (model.v): the model and normal matrices
+// replace the uniforms of the same name and the color replaces localColor
+struct InstanceData
+{
+    glm::mat4 transform;
+    glm::mat3 normalMatrix; // normalMatrix(transform)
+    glm::vec3 color;
+};
+static_assert(sizeof(InstanceData) == 112, "InstanceData is uploaded as is");
+
+// attribute locations, after the 7 used by Vertex
+enum InstanceAttribute
+{
+    INSTANCE_ATTRIBUTE_TRANSFORM = 7,      // mat4, locations 7 to 10
+    INSTANCE_ATTRIBUTE_COLOR = 11,
+    INSTANCE_ATTRIBUTE_NORMAL_MATRIX = 12  // mat3, locations 12 to 14
+};
+
+// A vertex buffer of InstanceData, rewritten whenever the instances change (every frame for animated ones). Each upload
+// orphans the old storage, so the driver never has to wait for draws still reading it. Drawing needs a VAO that has
+// both the geometry and the instance attributes; vertexArray() makes one per arena on first use. GL thread only,
+// freed by release() like the other GL wrappers.
+class InstanceBuffer
+{
+public:
+    InstanceBuffer() {}
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    void create()
+    {
+        glGenBuffers(1, &VBO);
+    }
+
+    void release()
+    {
+        for (const auto& entry : vertexArrays)
+        {
+            GlState::get().forgetVertexArray(entry.second);
+            glDeleteVertexArrays(1, &entry.second);
+        }
+        vertexArrays.clear();
+        glDeleteBuffers(1, &VBO);
+        VBO = 0;
+        capacity = count = 0;
+    }
+
+    void update(const InstanceData* instances, size_t instanceCount)
+    {
+        // grow with some room so a slowly growing count doesn't need a bigger buffer every frame
+        if (instanceCount > capacity)
+            capacity = instanceCount + instanceCount / 2;
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), nullptr, GL_STREAM_DRAW); // orphan
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(InstanceData), instances);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        count = instanceCount;
+    }
+
+    void update(const std::vector<InstanceData>& instances)
+    {
+        update(instances.data(), instances.size());
+    }
+
+    size_t size() const { return count; }
+
+    // a VAO that draws arena's geometry with these instances. The arena has to be uploaded.
+    GLuint vertexArray(const GeometryArena& arena)
+    {
+        auto found = vertexArrays.find(&arena);
+        if (found != vertexArrays.end())
+            return found->second;
+        GLuint vertexArray = 0;
+        glGenVertexArrays(1, &vertexArray);
+        GlState::get().bindVertexArray(vertexArray);
+        arena.attachBuffers();
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        for (int column = 0; column < 4; column++)
+        {
+            GLuint location = INSTANCE_ATTRIBUTE_TRANSFORM + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, transform) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+        }
+        for (int column = 0; column < 3; column++)
+        {
+            GLuint location = INSTANCE_ATTRIBUTE_NORMAL_MATRIX + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, normalMatrix) + column * sizeof(glm::vec3)));
+            glVertexAttribDivisor(location, 1);
+        }
+        glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_COLOR);
+        glVertexAttribPointer(INSTANCE_ATTRIBUTE_COLOR, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, color));
+        glVertexAttribDivisor(INSTANCE_ATTRIBUTE_COLOR, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        vertexArrays[&arena] = vertexArray;
+        return vertexArray;
+    }
+
+    // drops the VAO made for arena, call before the arena is released
+    void forget(const GeometryArena& arena)
+    {
+        auto found = vertexArrays.find(&arena);
+        if (found == vertexArrays.end())
+            return;
+        GlState::get().forgetVertexArray(found->second);
+        glDeleteVertexArrays(1, &found->second);
+        vertexArrays.erase(found);
+    }
+
+private:
+    unsigned int VBO = 0;
+    size_t capacity = 0;
+    size_t count = 0;
+    std::unordered_map<const GeometryArena*, GLuint> vertexArrays;
+};
+#endif
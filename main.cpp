@@ -8,7 +8,19 @@
 #include "camera.h"
 #include "mesh.h"
 #include "model.h"
+#include "sceneGraph.h"
+#include "modelLoader.h"
+#include "benchmarks.h"
+#include "clusteredLighting.h"
+#include "deferredShading.h"
+#include "frustumCulling.h"
+#include "glState.h"
+#include "gpuProfiler.h"
+#include "instancing.h"
 #include "shader_s.h"
+#include "shaderLibrary.h"
+#include "shaderWatcher.h"
+#include "uniformBlocks.h"
 #include "filesystem.h"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -18,11 +30,11 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
+#include <cmath>
 #include <iostream>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
-unsigned int loadTexture(const char* path);
 
 // settings
 const unsigned int SCR_WIDTH = 1280;
@@ -71,6 +83,8 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // linked shader programs are cached on disk from here on
+    ProgramCache::get().init((GLADloadproc)glfwGetProcAddress);
 
     // imgui setup
     IMGUI_CHECKVERSION();
@@ -80,20 +94,53 @@ int main()
     ImGui_ImplOpenGL3_Init("#version 330");
     //ImGui::StyleColorsLight();
 
-    glEnable(GL_DEPTH_TEST);
+    GlState::get().setEnabled(GL_DEPTH_TEST, true);
 
     stbi_set_flip_vertically_on_load(true);
 
     // build and compile shaders
     // -------------------------
 
+    // Model selection
+    const char* modelNames[] = { "Suzanne", "Utah Teapot", "Torus"};
+    const char* modelPaths[] = {
+        "resources/suzanne/suzanne.obj",
+        "resources/teapot.obj",
+        "resources/coffee_cup.obj"
+    };
+    int currentModelIndex = 0; // Start with Suzanne (index 0)
+    bool packedVertices = false; // upload ourModel with the 20 byte PackedVertex layout instead of the full Vertex
+
+    // level of detail: each draw picks the coarsest LOD whose error stays below lodPixelError pixels on screen
+    bool autoLod = true;
+    float lodPixelError = 1.0f;
+    bool showLodOverlay = false;
+    struct LodLabel
+    {
+        ImVec2 screenPosition;
+        int lod;
+        int triangles;
+        float radius; // projected bounding sphere radius in pixels
+    };
+    std::vector<LodLabel> lodLabels; // filled while drawing, shown by the overlay
+
+    BenchmarkLog benchmarkLog; // results of the benchmarks started from the UI, declared first so it outlives their jobs on workerPool
+    bool runUniformBenchmark = false; // needs the GL context, so it runs on this thread between frames
+
+    // Background loading, also used for model switches where the old model keeps rendering until the new one is uploaded
+    ThreadPool workerPool;
+    ModelLoader modelLoader(workerPool);
+    unsigned int pendingModelTicket = 0; // latest requested model, older requests that finish late are dropped
+
     // load textures
     // -------------
-    unsigned int floorTexture = loadTexture("resources/container.jpg");
-    Shader* floorShader = new Shader("shaders/model/floor.v", "shaders/model/blinnPhong.f");
-    floorShader->use();
-    floorShader->setBool("useTexture", true);
-    floorShader->setInt("texture_diffuse1", 0);
+    // startup assets load in parallel: both models are imported and their textures decoded on the worker threads
+    // while the floor texture is decoded and the shaders are compiled, then everything is uploaded on this thread
+    unsigned int ourModelTicket = modelLoader.request(modelPaths[currentModelIndex]);
+    unsigned int lightModelTicket = modelLoader.request("resources/sphere.obj");
+    TextureBatch startupTextures(workerPool);
+    startupTextures.add("resources/container.jpg");
+    unsigned int floorTexture = startupTextures.load()[0];
 
     // Model shader selection system
     const char* modelShaderNames[] = { "Blinn-Phong", "Fresnel", "OS Normals", "Cell Shaded" };
@@ -104,10 +151,61 @@ int main()
         "Shaders/model/cellShading.f"
     };
     int currentModelShaderIndex = 0;
-    Shader* modelShader = new Shader("Shaders/model/model.v", modelShaderPaths[currentModelShaderIndex]);
 
-    // Light sphere shader
-    Shader lightShader("shaders/model/model.v", "shaders/model/light.f");
+    // shader knobs, compile-time defines: changing one builds (once) and switches to a specialized variant
+    int shadingLevels = 3;      // cellShading.f SHADING_LEVELS
+    int kuwaharaRadius = 2;     // ppKuwahara.f RADIUS
+    float blurStrength = 5.0f;  // ppGaussian.f BLUR_STRENGTH
+    float ditherSize = 2.0f;    // ppDithering.f DITHER_SIZE
+    int bitDepth = 4;           // ppDithering.f BIT_DEPTH
+    float worleyScale = 70.0f;  // ppWorley.f SCALE
+    auto modelShaderDefines = [&](int index, bool instanced) {
+        ShaderDefines defines;
+        if (instanced)
+            defines.push_back(shaderDefine("INSTANCED", 1));
+        if (index == 3)
+            defines.push_back(shaderDefine("SHADING_LEVELS", shadingLevels));
+        return defines;
+    };
+    auto screenShaderDefines = [&](int index) {
+        ShaderDefines defines;
+        if (index == 2)
+        {
+            defines.push_back(shaderDefine("DITHER_SIZE", ditherSize));
+            defines.push_back(shaderDefine("BIT_DEPTH", static_cast<float>(bitDepth)));
+        }
+        else if (index == 3)
+            defines.push_back(shaderDefine("BLUR_STRENGTH", blurStrength));
+        else if (index == 4)
+            defines.push_back(shaderDefine("RADIUS", kuwaharaRadius));
+        else if (index == 7)
+            defines.push_back(shaderDefine("SCALE", worleyScale));
+        return defines;
+    };
+
+    // every selectable shader is built at startup (by the driver's compiler threads where it has them), so picking one
+    // in the UI is only a pointer swap
+    ShaderLibrary shaderLibrary((GLADloadproc)glfwGetProcAddress);
+    int modelShaderIds[IM_ARRAYSIZE(modelShaderPaths)];
+    int instancedShaderIds[IM_ARRAYSIZE(modelShaderPaths)]; // the same with per-instance transform and color
+    for (int i = 0; i < IM_ARRAYSIZE(modelShaderPaths); i++)
+    {
+        modelShaderIds[i] = shaderLibrary.add("Shaders/model/model.v", modelShaderPaths[i], modelShaderDefines(i, false));
+        instancedShaderIds[i] = shaderLibrary.add("Shaders/model/model.v", modelShaderPaths[i], modelShaderDefines(i, true));
+    }
+
+    // Floor and light sphere shaders
+    int floorShaderId = shaderLibrary.add("shaders/model/floor.v", "shaders/model/blinnPhong.f");
+    int lightShaderId = shaderLibrary.add("shaders/model/model.v", "shaders/model/light.f");
+
+    // deferred shading: the surface into the G-buffer for the model (plain and instanced) and the floor, then one
+    // Blinn-Phong lighting pass over it
+    ShaderDefines instancedDefines;
+    instancedDefines.push_back(shaderDefine("INSTANCED", 1));
+    int gBufferShaderId = shaderLibrary.add("shaders/model/model.v", "shaders/deferred/gBuffer.f");
+    int gBufferInstancedShaderId = shaderLibrary.add("shaders/model/model.v", "shaders/deferred/gBuffer.f", instancedDefines);
+    int gBufferFloorShaderId = shaderLibrary.add("shaders/model/floor.v", "shaders/deferred/gBuffer.f");
+    int deferredLightingShaderId = shaderLibrary.add("shaders/postProcessing/screen.v", "shaders/deferred/lighting.f");
 
     // Model local color (adjustable via color picker)
     float modelLocalColor[3] = { 0.82f, 0.09f, 0.09f }; // RGB color
@@ -123,19 +221,41 @@ int main()
     float lightLinear = 0.09f;
     float lightQuadratic = 0.032f;
 
-    // Model selection
-    const char* modelNames[] = { "Suzanne", "Utah Teapot", "Torus"};
-    const char* modelPaths[] = {
-        "resources/suzanne/suzanne.obj",
-        "resources/teapot.obj",
-        "resources/coffee_cup.obj"
+    // camera and light live in uniform buffers shared by every program instead of per-program uniforms
+    UniformBuffer<CameraBlock> cameraUniforms(UNIFORM_BLOCK_CAMERA);
+    UniformBuffer<LightBlock> lightUniforms(UNIFORM_BLOCK_LIGHTS);
+    cameraUniforms.create();
+    lightUniforms.create();
+
+    // clustered point lights: a field of small colored lights circling over the floor, on top of the scene light. The
+    // count is the benchmark knob, the lights are binned on the workers every frame.
+    const char* pointLightNames[] = { "Off", "64", "1024", "4096" };
+    const int pointLightCounts[] = { 0, 64, 1024, 4096 };
+    int pointLightIndex = 0;
+    float pointLightRadius = 0.6f;
+    float pointLightIntensity = 1.0f;
+    std::vector<PointLight> pointLights;
+    LightClusters lightClusters;
+    lightClusters.create();
+    UniformBuffer<ClusterBlock> clusterUniforms(UNIFORM_BLOCK_CLUSTERS);
+    clusterUniforms.create();
+
+    // uploads a model the loader finished, a model that failed to load is reported and drawn as nothing
+    auto uploadModel = [](ModelData& data)
+    {
+        if (data.valid)
+            return new Model(data);
+        std::cout << "ERROR::MODEL::LOAD_FAILED: " << data.path << std::endl;
+        return new Model();
     };
-    int currentModelIndex = 0; // Start with Suzanne (index 0)
-    // Load model
-    Model* ourModel = new Model(modelPaths[currentModelIndex]);
+
+    // Load model (imported in the background since startup, only uploaded here)
+    Model* ourModel = uploadModel(*modelLoader.wait(ourModelTicket));
+    int shownModelIndex = currentModelIndex; // the model ourModel holds, the combo goes back to it if a switch fails
 
     // Load light sphere model
-    Model* lightModel = new Model("resources/sphere.obj");
+    Model* lightModel = uploadModel(*modelLoader.wait(lightModelTicket));
+    TextureCache::get().printLoadReport();
 
     // Post-processing shader selection system
     const char* shaderNames[] = { "None", "Invert", "Dithering", "Gaussian Blur", "Kuwahara", "Sharpen", "Sobel", "Worley" };
@@ -150,7 +270,78 @@ int main()
         "shaders/postProcessing/ppWorley.f",
     };
     int currentShaderIndex = 0;
-    Shader* screenShader = new Shader("shaders/postProcessing/screen.v", shaderPaths[currentShaderIndex]);
+    int screenShaderIds[IM_ARRAYSIZE(shaderPaths)];
+    for (int i = 0; i < IM_ARRAYSIZE(shaderPaths); i++)
+        screenShaderIds[i] = shaderLibrary.add("shaders/postProcessing/screen.v", shaderPaths[i], screenShaderDefines(i));
+    shaderLibrary.finishStartup();
+    Shader* modelShader = shaderLibrary.get(modelShaderIds[currentModelShaderIndex]);
+    Shader* screenShader = shaderLibrary.get(screenShaderIds[currentShaderIndex]);
+    // the variants in use; a knob points modelShaderIds/screenShaderIds at a new one, which replaces these once built
+    int activeModelShaderId = modelShaderIds[currentModelShaderIndex];
+    Shader* instancedShader = shaderLibrary.get(instancedShaderIds[currentModelShaderIndex]);
+    int activeInstancedShaderId = instancedShaderIds[currentModelShaderIndex];
+
+    // stress scene: a grid of animated copies of the model, drawn with one instanced draw per mesh or one draw per copy
+    const char* stressSceneNames[] = { "Off", "1k", "10k", "100k" };
+    const int stressSceneCounts[] = { 0, 1000, 10000, 100000 };
+    int stressSceneIndex = 0;
+    bool stressInstanced = true;
+    std::vector<InstanceData> stressData;
+    InstanceBuffer stressInstances; // streamed every frame
+    stressInstances.create();
+    std::vector<InstanceData> stressVisible; // the copies that passed culling, uploaded for the instanced draw
+    float cpuFrameMs = 0.0f; // CPU time of the last frame up to the buffer swap
+
+    // the scene: a node per object that places it, with the model's own hierarchy below. The transforms are set once,
+    // so the per-frame update finds nothing dirty; the graph is rebuilt when the model changes.
+    struct SceneObject
+    {
+        Model* model;
+        int node;
+        ModelInstance instance; // graph nodes of the model's nodes and instance buffers of its shared meshes
+    };
+    const size_t SCENE_OBJECT_COUNT = 3; // two copies of the model and the light; the stress copies follow them
+    SceneGraph sceneGraph;
+    SceneObject sceneObjects[SCENE_OBJECT_COUNT];
+    size_t sceneNodesUpdated = 0;
+    auto buildScene = [&]
+    {
+        for (SceneObject& object : sceneObjects)
+            object.instance.release();
+        sceneGraph.clear();
+        int node = sceneGraph.add(SceneGraph::NO_PARENT, glm::vec3(0.2f, 0.2f, 0.25f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.7f));
+        sceneObjects[0] = { ourModel, node, ourModel->instantiate(sceneGraph, node) };
+        // Second model - at an angle
+        glm::quat rotation = glm::angleAxis(glm::radians(-75.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::angleAxis(glm::radians(15.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        node = sceneGraph.add(SceneGraph::NO_PARENT, glm::vec3(-0.8f, 0.3f, 0.5f), rotation, glm::vec3(0.4f));
+        sceneObjects[1] = { ourModel, node, ourModel->instantiate(sceneGraph, node) };
+        // Light sphere
+        node = sceneGraph.add(SceneGraph::NO_PARENT, LIGHT_POSITION, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), LIGHT_SCALE);
+        sceneObjects[2] = { lightModel, node, lightModel->instantiate(sceneGraph, node) };
+    };
+    buildScene();
+
+    // culling: the world space box of every scene object, tested against the view frustum before anything is queued
+    bool frustumCulling = true;
+    CullingSet sceneBounds;
+    std::vector<uint32_t> visibleObjects;
+    float cullMs = 0.0f;
+    int activeScreenShaderId = screenShaderIds[currentShaderIndex];
+    Shader* floorShader = shaderLibrary.get(floorShaderId);
+    floorShader->use();
+    floorShader->setBool("useTexture", true);
+    floorShader->setInt("texture_diffuse1", 0);
+    Shader* lightShader = shaderLibrary.get(lightShaderId);
+    Shader* gBufferShader = shaderLibrary.get(gBufferShaderId);
+    Shader* gBufferInstancedShader = shaderLibrary.get(gBufferInstancedShaderId);
+    Shader* gBufferFloorShader = shaderLibrary.get(gBufferFloorShaderId);
+    gBufferFloorShader->use();
+    gBufferFloorShader->setBool("useTexture", true);
+    gBufferFloorShader->setInt("texture_diffuse1", 0);
+    Shader* deferredLightingShader = shaderLibrary.get(deferredLightingShaderId);
+
+    // edits to the shaders are picked up while running, see ShaderLibrary::reload()
+    ShaderWatcher shaderWatcher("shaders");
 
 #pragma region data
     // set up vertex data (and buffer(s)) and configure vertex attributes
@@ -220,41 +411,36 @@ int main()
          1.0f,  1.0f,  1.0f, 1.0f
     };
 #pragma endregion
-    // cube VAO
-    unsigned int cubeVAO, cubeVBO;
-    glGenVertexArrays(1, &cubeVAO);
-    glGenBuffers(1, &cubeVBO);
-    glBindVertexArray(cubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    // plane VAO
-    unsigned int planeVAO, planeVBO;
-    glGenVertexArrays(1, &planeVAO);
-    glGenBuffers(1, &planeVBO);
-    glBindVertexArray(planeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), &planeVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    // screen quad VAO
-    unsigned int quadVAO, quadVBO;
-    glGenVertexArrays(1, &quadVAO);
-    glGenBuffers(1, &quadVBO);
-    glBindVertexArray(quadVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+    // static geometry: the cube, plane and quad share one arena (one VAO) with the models' vertex layout
+    auto makeVertex = [](glm::vec3 position, glm::vec3 normal, glm::vec2 texCoords)
+    {
+        Vertex vertex = {};
+        vertex.Position = position;
+        vertex.Normal = normal;
+        vertex.TexCoords = texCoords;
+        vertex.Tangent = glm::vec3(0.0f);
+        vertex.Bitangent = glm::vec3(0.0f);
+        return vertex;
+    };
+    vector<Vertex> cubeMesh, planeMesh, quadMesh;
+    for (size_t i = 0; i < sizeof(cubeVertices) / sizeof(float); i += 5)
+        cubeMesh.push_back(makeVertex(glm::vec3(cubeVertices[i], cubeVertices[i + 1], cubeVertices[i + 2]), glm::vec3(0.0f), glm::vec2(cubeVertices[i + 3], cubeVertices[i + 4])));
+    for (size_t i = 0; i < cubeMesh.size(); i += 3) // the array has no normals, use the face normal of each triangle
+    {
+        glm::vec3 normal = glm::normalize(glm::cross(cubeMesh[i + 1].Position - cubeMesh[i].Position, cubeMesh[i + 2].Position - cubeMesh[i].Position));
+        cubeMesh[i].Normal = cubeMesh[i + 1].Normal = cubeMesh[i + 2].Normal = normal;
+    }
+    for (size_t i = 0; i < sizeof(planeVertices) / sizeof(float); i += 8)
+        planeMesh.push_back(makeVertex(glm::vec3(planeVertices[i], planeVertices[i + 1], planeVertices[i + 2]), glm::vec3(planeVertices[i + 3], planeVertices[i + 4], planeVertices[i + 5]), glm::vec2(planeVertices[i + 6], planeVertices[i + 7])));
+    for (size_t i = 0; i < sizeof(quadVertices) / sizeof(float); i += 4)
+        quadMesh.push_back(makeVertex(glm::vec3(quadVertices[i], quadVertices[i + 1], 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(quadVertices[i + 2], quadVertices[i + 3])));
+
+    GeometryArena staticGeometry(vertexLayout(VERTEX_FORMAT_FULL));
+    ArenaRange cubeRange = staticGeometry.add(cubeMesh.data(), cubeMesh.size());
+    ArenaRange planeRange = staticGeometry.add(planeMesh.data(), planeMesh.size());
+    ArenaRange quadRange = staticGeometry.add(quadMesh.data(), quadMesh.size());
+    staticGeometry.upload();
+    (void)cubeRange; // not drawn by any pass at the moment
 
     // shader configuration
     // --------------------
@@ -265,11 +451,11 @@ int main()
     // -------------------------
     unsigned int framebuffer;
     glGenFramebuffers(1, &framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    GlState::get().bindFramebuffer(framebuffer);
     // create a color attachment texture
     unsigned int textureColorbuffer;
     glGenTextures(1, &textureColorbuffer);
-    glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
+    GlState::get().bindTexture(0, GL_TEXTURE_2D, textureColorbuffer);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -285,11 +471,46 @@ int main()
     // now that we actually created the framebuffer and added all attachments we want to check if it is actually complete now
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GlState::get().bindFramebuffer(0);
+
+    // forward draws the lit scene straight into the framebuffer above, deferred fills the G-buffer and lights it into
+    // the same framebuffer, so the post-processing pass is the same for both
+    bool deferredShading = false;
+    GBuffer gBuffer;
+    gBuffer.create(SCR_WIDTH, SCR_HEIGHT);
 
     // draw as wireframe
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+    // GPU time per render pass, shown in the ImGui window
+    GpuProfiler gpuProfiler;
+    RenderQueue renderQueue; // the draws of a frame, sorted to keep program, texture and VAO changes down
+    const int clearPass = gpuProfiler.addPass("Clear");
+    const int scenePass = gpuProfiler.addPass("Scene");
+    const int lightingPass = gpuProfiler.addPass("Lights"); // deferred lighting and the unlit geometry after it
+    const int postProcessingPass = gpuProfiler.addPass("Post");
+    const int imguiPass = gpuProfiler.addPass("ImGui");
+
+    // forward against deferred: both modes with 1, 64 and 1024 lights (the scene light alone, then the clustered
+    // lights on top of it), each held for a while and measured once the profiler only has its frames
+    struct ShadingSweepStep
+    {
+        bool deferred;
+        int pointLightIndex;
+        const char* lights;
+    };
+    const ShadingSweepStep shadingSweep[] = {
+        { false, 0, "1" }, { true, 0, "1" }, { false, 1, "1+64" }, { true, 1, "1+64" }, { false, 2, "1+1024" }, { true, 2, "1+1024" }
+    };
+    const int SWEEP_SETTLE_FRAMES = 2 * GpuProfiler::LATENCY; // results of the previous step are still arriving
+    const int SWEEP_FRAMES = 120;
+    int sweepStep = -1; // the step being measured, -1 when no sweep runs
+    int sweepFrame = 0;
+    float sweepCpuMs = 0.0f;
+    bool sweepRestoreDeferred = false;
+    int sweepRestorePointLights = 0;
+    bool sweepRestoreTimerQueries = true;
+
     // render loop
     // -----------
     while (!glfwWindowShouldClose(window))
@@ -297,6 +518,7 @@ int main()
         // per-frame time logic
         // --------------------
         float currentFrame = static_cast<float>(glfwGetTime());
+        auto cpuFrameStart = std::chrono::steady_clock::now();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
@@ -304,6 +526,60 @@ int main()
         // -----
         processInput(window);
 
+        if (sweepStep >= 0)
+        {
+            deferredShading = shadingSweep[sweepStep].deferred;
+            pointLightIndex = shadingSweep[sweepStep].pointLightIndex;
+        }
+
+        // pick up shaders the driver finished compiling in the background, and rebuild the ones edited on disk
+        shaderLibrary.reload(shaderWatcher.poll());
+        shaderLibrary.update();
+        // the current shader keeps rendering until a variant requested by a knob is ready
+        if (modelShaderIds[currentModelShaderIndex] != activeModelShaderId && shaderLibrary.ready(modelShaderIds[currentModelShaderIndex]))
+        {
+            activeModelShaderId = modelShaderIds[currentModelShaderIndex];
+            modelShader = shaderLibrary.get(activeModelShaderId);
+        }
+        if (instancedShaderIds[currentModelShaderIndex] != activeInstancedShaderId && shaderLibrary.ready(instancedShaderIds[currentModelShaderIndex]))
+        {
+            activeInstancedShaderId = instancedShaderIds[currentModelShaderIndex];
+            instancedShader = shaderLibrary.get(activeInstancedShaderId);
+        }
+        if (screenShaderIds[currentShaderIndex] != activeScreenShaderId && shaderLibrary.ready(screenShaderIds[currentShaderIndex]))
+        {
+            activeScreenShaderId = screenShaderIds[currentShaderIndex];
+            screenShader = shaderLibrary.get(activeScreenShaderId);
+            screenShader->use();
+            screenShader->setInt("screenTexture", 0);
+        }
+
+        // swap in a model that finished loading in the background, only the GL upload happens on this thread
+        unsigned int loadedTicket;
+        std::unique_ptr<ModelData> loadedModel;
+        while (modelLoader.poll(loadedTicket, loadedModel))
+        {
+            if (loadedTicket != pendingModelTicket)
+                continue;
+            if (!loadedModel->valid)
+            {
+                // keep drawing the current model and show it in the UI again
+                std::cout << "ERROR::MODEL::LOAD_FAILED: " << loadedModel->path << ", keeping " << modelNames[shownModelIndex] << std::endl;
+                currentModelIndex = shownModelIndex;
+                packedVertices = ourModel->vertexFormat == VERTEX_FORMAT_PACKED;
+                continue;
+            }
+            // the new model takes its texture references before the old one drops its own: the loader didn't decode
+            // the images that were already in the TextureCache, they would be decoded again here otherwise
+            Model* previousModel = ourModel;
+            ourModel = new Model(*loadedModel);
+            stressInstances.forget(previousModel->arena);
+            delete previousModel;
+            shownModelIndex = currentModelIndex;
+            buildScene();
+            std::cout << "Switched to model: " << modelNames[currentModelIndex] << std::endl;
+        }
+
         // start camera per frame logic
         float angle;
         if (autoSpin)
@@ -330,94 +606,238 @@ int main()
 
         // render
         // ------
+        gpuProfiler.beginFrame();
+        GlState::get().beginFrame();
         // bind to framebuffer and draw scene as we normally would to color texture 
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glEnable(GL_DEPTH_TEST); // enable depth testing (is disabled for rendering screen-space quad)
+        GlState::get().bindFramebuffer(framebuffer);
+        GlState::get().setEnabled(GL_DEPTH_TEST, true); // enable depth testing (is disabled for rendering screen-space quad)
 
         // make sure we clear the framebuffer's content
+        gpuProfiler.begin(clearPass);
         glClearColor(0.13f, 0.13f, 0.13f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (deferredShading)
+            gBuffer.begin(); // the scene pass draws into the G-buffer then
+        gpuProfiler.end();
 
         // Setup common view and projection matrices
         glm::mat4 view = camera.GetViewMatrix();
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 
+        // upload the shared camera and light blocks, once for all programs (the light only when it changed)
+        CameraBlock cameraBlock = {};
+        cameraBlock.view = view;
+        cameraBlock.projection = projection;
+        cameraBlock.viewPos = camera.Position;
+        cameraUniforms.update(cameraBlock);
+        LightBlock lightBlock = {};
+        lightBlock.position = LIGHT_POSITION;
+        lightBlock.ambient = lightAmbient;
+        lightBlock.diffuse = lightDiffuse;
+        lightBlock.specular = lightSpecular;
+        lightBlock.constant = lightConstant;
+        lightBlock.linear = lightLinear;
+        lightBlock.quadratic = lightQuadratic;
+        lightBlock.color = glm::vec3(lightColor[0], lightColor[1], lightColor[2]);
+        lightUniforms.update(lightBlock);
+
+        // place the point lights for this frame and bin them for this camera before anything is drawn
+        int pointLightCount = pointLightCounts[pointLightIndex];
+        pointLights.resize(pointLightCount);
+        for (int i = 0; i < pointLightCount; i++)
+        {
+            // a fixed spot, phase and hue per index (an R2 sequence), so changing the count keeps the other lights in place
+            float u = std::fmod(0.5f + i * 0.7548777f, 1.0f);
+            float v = std::fmod(0.5f + i * 0.5698403f, 1.0f);
+            float phase = currentFrame * 0.5f + i * 2.3999632f;
+            pointLights[i].position = glm::vec3(u * 10.0f - 5.0f + 0.3f * std::cos(phase), -0.35f + 0.25f * std::fmod(i * 0.618034f, 1.0f), v * 10.0f - 5.0f + 0.3f * std::sin(phase));
+            pointLights[i].radius = pointLightRadius;
+            float hue = (i % 64) / 64.0f * 6.2831853f;
+            pointLights[i].color = pointLightIntensity * glm::vec3(0.5f + 0.5f * std::cos(hue), 0.5f + 0.5f * std::cos(hue - 2.094f), 0.5f + 0.5f * std::cos(hue + 2.094f));
+        }
+        if (pointLightCount > 0)
+        {
+            lightClusters.build(pointLights, view, projection, &workerPool);
+            lightClusters.upload();
+        }
+        else
+            lightClusters.clear();
+        clusterUniforms.update(lightClusters.block((float)SCR_WIDTH, (float)SCR_HEIGHT));
+        lightClusters.bind();
+
+        // the programs of the scene pass, the lit ones or the G-buffer ones
+        Shader* sceneShader = deferredShading ? gBufferShader : modelShader;
+        Shader* sceneInstancedShader = deferredShading ? gBufferInstancedShader : instancedShader;
+
+        // queues a model at the LOD its screen size calls for and remembers the choice for the overlay
+        lodLabels.clear();
+        renderQueue.clear();
+        auto submitModel = [&](const SceneObject& object, Shader& shader, RenderPass pass)
+        {
+            const Model& model = *object.model;
+            glm::mat4 modelView = view * sceneGraph.world(object.node);
+            int lod = autoLod ? model.selectLod(modelView, projection, (float)SCR_HEIGHT, lodPixelError) : 0;
+            glm::vec3 center = glm::vec3(modelView * glm::vec4(model.bounds.center, 1.0f));
+            // meshes several nodes reference go through the instanced program, the light's shader has no such variant
+            model.Submit(renderQueue, pass, shader, sceneGraph, object.instance, object.model == ourModel ? sceneInstancedShader : nullptr, lod, -center.z);
+
+            glm::vec4 clip = projection * modelView * glm::vec4(model.bounds.center, 1.0f);
+            if (clip.w > 0.0f)
+            {
+                ImVec2 screen((clip.x / clip.w * 0.5f + 0.5f) * SCR_WIDTH, (0.5f - clip.y / clip.w * 0.5f) * SCR_HEIGHT);
+                lodLabels.push_back({ screen, lod, model.lodTriangles(lod), model.projectedRadius(modelView, projection, (float)SCR_HEIGHT) });
+            }
+        };
+
+        // per-frame uniforms of the programs, before the queue runs
         modelShader->use();
-        // Pass point light uniforms (OpenGL ignores uniforms not used by the shader)
-        modelShader->setVec3("light.position", LIGHT_POSITION);
-        modelShader->setVec3("light.ambient", lightAmbient);
-        modelShader->setVec3("light.diffuse", lightDiffuse);
-        modelShader->setVec3("light.specular", lightSpecular);
-        modelShader->setFloat("light.constant", lightConstant);
-        modelShader->setFloat("light.linear", lightLinear);
-        modelShader->setFloat("light.quadratic", lightQuadratic);
-
-        // Pass model local color and light color
+        // Pass model local color (light and camera come from the uniform blocks)
         modelShader->setVec3("localColor", glm::vec3(modelLocalColor[0], modelLocalColor[1], modelLocalColor[2]));
-        modelShader->setVec3("lightColor", glm::vec3(lightColor[0], lightColor[1], lightColor[2]));
-        modelShader->setVec3("viewPos", camera.Position);
         modelShader->setBool("useTexture", false); // Set to true if you want to use textures
+        instancedShader->use();
+        instancedShader->setBool("useTexture", false);
+        if (deferredShading)
+        {
+            gBufferShader->use();
+            gBufferShader->setVec3("localColor", glm::vec3(modelLocalColor[0], modelLocalColor[1], modelLocalColor[2]));
+            gBufferShader->setBool("useTexture", false);
+            gBufferInstancedShader->use();
+            gBufferInstancedShader->setBool("useTexture", false);
+            deferredLightingShader->use();
+            deferredLightingShader->setMat4("inverseViewProjection", glm::inverse(projection * view));
+        }
 
-        // set matrix uniforms for model
-        modelShader->setMat4("projection", projection);
-        modelShader->setMat4("view", view);
-        glm::mat4 modelMatrix = glm::mat4(1.0f);
-        modelMatrix = glm::translate(modelMatrix, glm::vec3(0.2f, 0.2f, 0.25f));
-        modelMatrix = glm::scale(modelMatrix, glm::vec3(0.7f, 0.7f, 0.7f));
-        modelShader->setMat4("model", modelMatrix);
-        ourModel->Draw(*modelShader);
-
-        // Second model - at an angle
-        glm::mat4 modelMatrix2 = glm::mat4(1.0f);
-        modelMatrix2 = glm::translate(modelMatrix2, glm::vec3(-0.8f, 0.3f, 0.5f));
-        modelMatrix2 = glm::rotate(modelMatrix2, glm::radians(-75.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        modelMatrix2 = glm::rotate(modelMatrix2, glm::radians(15.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        modelMatrix2 = glm::scale(modelMatrix2, glm::vec3(0.4f));
-        modelShader->setMat4("model", modelMatrix2);
-        ourModel->Draw(*modelShader);
+        // world matrices of whatever moved since the last frame, and the instance buffers of the nodes that moved
+        sceneNodesUpdated = sceneGraph.update();
+        for (SceneObject& object : sceneObjects)
+            if (object.model == ourModel)
+                ourModel->updateInstance(object.instance, sceneGraph, glm::vec3(modelLocalColor[0], modelLocalColor[1], modelLocalColor[2]));
+        // the light sphere isn't lit, deferred draws it forward over the lit image
+        Shader* objectShaders[SCENE_OBJECT_COUNT] = { sceneShader, sceneShader, lightShader };
+        RenderPass objectPasses[SCENE_OBJECT_COUNT] = { RENDER_PASS_SCENE, RENDER_PASS_SCENE, deferredShading ? RENDER_PASS_FORWARD : RENDER_PASS_SCENE };
+        int stressCount = stressSceneCounts[stressSceneIndex];
+        sceneBounds.resize(SCENE_OBJECT_COUNT + stressCount);
+        for (size_t i = 0; i < SCENE_OBJECT_COUNT; i++)
+            sceneBounds.set(i, sceneObjects[i].model->bounds, sceneGraph.world(sceneObjects[i].node));
+
+        // stress scene, transforms, colors and boxes recomputed every frame on the worker threads
+        if (stressCount > 0)
+        {
+            const float SPACING = 0.35f;
+            const size_t CHUNK = 1024;
+            int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(stressCount))));
+            stressData.resize(stressCount);
+            workerPool.parallelFor((stressCount + CHUNK - 1) / CHUNK, [&](size_t chunk)
+            {
+                for (size_t i = chunk * CHUNK; i < std::min(stressData.size(), (chunk + 1) * CHUNK); i++)
+                {
+                    float x = (static_cast<int>(i % side) - side * 0.5f) * SPACING;
+                    float z = (static_cast<int>(i / side) - side * 0.5f) * SPACING;
+                    glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(x, -0.3f, z));
+                    transform = glm::rotate(transform, currentFrame + i * 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+                    stressData[i].transform = glm::scale(transform, glm::vec3(0.1f));
+                    stressData[i].normalMatrix = normalMatrix(stressData[i].transform);
+                    sceneBounds.set(SCENE_OBJECT_COUNT + i, ourModel->bounds, stressData[i].transform);
+                    float hue = (i % 64) / 64.0f * 6.2831853f;
+                    stressData[i].color = glm::vec3(0.5f + 0.5f * std::cos(hue), 0.5f + 0.5f * std::cos(hue - 2.094f), 0.5f + 0.5f * std::cos(hue + 2.094f));
+                }
+            });
+        }
 
-        // Light sphere
-        lightShader.use();
-        lightShader.setMat4("view", view);
-        lightShader.setMat4("projection", projection);
-        lightShader.setVec3("lightColor", glm::vec3(lightColor[0], lightColor[1], lightColor[2]));
-        glm::mat4 lightModelMat = glm::mat4(1.0f);
-        lightModelMat = glm::translate(lightModelMat, LIGHT_POSITION);
-        lightModelMat = glm::scale(lightModelMat, LIGHT_SCALE);
-        lightShader.setMat4("model", lightModelMat);
-        lightModel->Draw(lightShader);
+        auto cullStart = std::chrono::steady_clock::now();
+        visibleObjects.clear();
+        if (frustumCulling)
+            sceneBounds.cull(Frustum(projection * view), visibleObjects);
+        else
+            for (size_t i = 0; i < sceneBounds.size(); i++)
+                visibleObjects.push_back(static_cast<uint32_t>(i));
+        cullMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+
+        // only what survived culling is queued; the indices are ascending, so the scene objects come first
+        stressVisible.clear();
+        int stressLod = autoLod ? std::max(0, ourModel->lodCount() - 1) : 0; // the copies are small, the coarsest level does
+        for (uint32_t index : visibleObjects)
+        {
+            if (index < SCENE_OBJECT_COUNT)
+                submitModel(sceneObjects[index], *objectShaders[index], objectPasses[index]);
+            else if (stressInstanced)
+                stressVisible.push_back(stressData[index - SCENE_OBJECT_COUNT]);
+            else
+            {
+                const glm::mat4& transform = stressData[index - SCENE_OBJECT_COUNT].transform;
+                ourModel->Submit(renderQueue, RENDER_PASS_SCENE, *sceneShader, transform, stressLod, -(view * transform[3]).z);
+            }
+        }
+        if (!stressVisible.empty())
+        {
+            stressInstances.update(stressVisible);
+            ourModel->SubmitInstanced(renderQueue, RENDER_PASS_SCENE, *sceneInstancedShader, stressInstances, stressLod);
+        }
 
         // floor using floorShader with texture
-        floorShader->use();
-        floorShader->setMat4("view", view);
-        floorShader->setMat4("projection", projection);
-        floorShader->setMat4("model", glm::mat4(1.0f));
-        floorShader->setVec3("viewPos", camera.Position);
-        floorShader->setVec3("light.position", LIGHT_POSITION);
-        floorShader->setVec3("light.ambient", lightAmbient);
-        floorShader->setVec3("light.diffuse", lightDiffuse);
-        floorShader->setVec3("light.specular", lightSpecular);
-        floorShader->setFloat("light.constant", lightConstant);
-        floorShader->setFloat("light.linear", lightLinear);
-        floorShader->setFloat("light.quadratic", lightQuadratic);
-        floorShader->setVec3("lightColor", glm::vec3(lightColor[0], lightColor[1], lightColor[2]));
-        glBindVertexArray(planeVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-
-        // now bind back to default framebuffer and draw a quad plane with the attached framebuffer color texture
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDisable(GL_DEPTH_TEST); // disable depth test so screen-space quad isn't discarded due to depth test.
+        DrawItem floorItem;
+        floorItem.shader = deferredShading ? gBufferFloorShader : floorShader;
+        floorItem.arena = &staticGeometry;
+        floorItem.range = planeRange;
+        floorItem.texture = floorTexture;
+        floorItem.hasTransform = true;
+        renderQueue.submit(RENDER_PASS_SCENE, floorItem, -(view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z);
+
+        // deferred: a quad that lights every pixel the scene pass covered
+        if (deferredShading)
+        {
+            DrawItem lightingItem;
+            lightingItem.shader = deferredLightingShader;
+            lightingItem.arena = &staticGeometry;
+            lightingItem.range = quadRange;
+            renderQueue.submit(RENDER_PASS_LIGHTING, lightingItem);
+        }
+
+        // a quad plane with the attached framebuffer color texture
+        DrawItem screenItem;
+        screenItem.shader = screenShader;
+        screenItem.arena = &staticGeometry;
+        screenItem.range = quadRange;
+        screenItem.texture = textureColorbuffer;	// use the color attachment texture as the texture of the quad plane
+        renderQueue.submit(RENDER_PASS_POST, screenItem);
+
+        // everything is sorted once, then drawn pass by pass grouped by program, textures and VAO
+        renderQueue.sort();
+        gpuProfiler.begin(scenePass);
+        renderQueue.execute(RENDER_PASS_SCENE);
+        gpuProfiler.end();
+
+        // deferred: light the G-buffer into the framebuffer, then draw the unlit geometry against the G-buffer's depth
+        gpuProfiler.begin(lightingPass);
+        if (deferredShading)
+        {
+            GlState::get().bindFramebuffer(framebuffer);
+            GlState::get().setEnabled(GL_DEPTH_TEST, false);
+            gBuffer.bindTextures();
+            renderQueue.execute(RENDER_PASS_LIGHTING);
+            gBuffer.blitDepth(framebuffer);
+            GlState::get().setEnabled(GL_DEPTH_TEST, true);
+            renderQueue.execute(RENDER_PASS_FORWARD);
+        }
+        gpuProfiler.end();
+
+        // now bind back to default framebuffer and draw the post-processing pass
+        gpuProfiler.begin(postProcessingPass);
+        GlState::get().bindFramebuffer(0);
+        GlState::get().setEnabled(GL_DEPTH_TEST, false); // disable depth test so screen-space quad isn't discarded due to depth test.
         // clear all relevant buffers
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f); // set clear color to white (not really necessary actually, since we won't be able to see behind the quad anyways)
         glClear(GL_COLOR_BUFFER_BIT);
+        renderQueue.execute(RENDER_PASS_POST);
+        gpuProfiler.end();
 
-        screenShader->use();
-        glBindVertexArray(quadVAO);
-        glBindTexture(GL_TEXTURE_2D, textureColorbuffer);	// use the color attachment texture as the texture of the quad plane
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        if (runUniformBenchmark)
+        {
+            benchmarkLog.clear();
+            modelShader->use();
+            benchmarkUniforms(*modelShader, benchmarkLog);
+            runUniformBenchmark = false;
+        }
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -433,11 +853,66 @@ int main()
         ImGui::Spacing();
         if (ImGui::Combo("##Model", &currentModelIndex, modelNames, IM_ARRAYSIZE(modelNames)))
         {
-            // Model selection changed, reload the model
-            delete ourModel;
-            ourModel = new Model(modelPaths[currentModelIndex]);
-            std::cout << "Switched to model: " << modelNames[currentModelIndex] << std::endl;
+            // Model selection changed, load the new model in the background
+            pendingModelTicket = modelLoader.request(modelPaths[currentModelIndex], packedVertices ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FULL);
+        }
+        if (ImGui::Checkbox("Packed Vertices", &packedVertices))
+        {
+            // reload the current model with the other vertex layout
+            pendingModelTicket = modelLoader.request(modelPaths[currentModelIndex], packedVertices ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FULL);
         }
+        if (modelLoader.busy())
+            ImGui::TextDisabled("Loading...");
+        ImGui::TextDisabled("%d textures, %.1f MB", (int)TextureCache::get().textureCount(), TextureCache::get().bytes() / (1024.0f * 1024.0f));
+        ImGui::TextDisabled("vertices %.1f KB", ourModel->vertexBytes() / 1024.0f);
+        ImGui::TextDisabled("%d programs cached %.1f ms", ProgramCache::get().hitCount(), ProgramCache::get().averageLoadMs());
+        ImGui::TextDisabled("%d programs built %.1f ms", ProgramCache::get().compileCount(), ProgramCache::get().averageCompileMs());
+        if (shaderLibrary.pendingCount() > 0)
+            ImGui::TextDisabled("%d shaders compiling", shaderLibrary.pendingCount());
+        else
+            ImGui::TextDisabled("shaders ready %.0f ms", shaderLibrary.startupMs());
+        ImGui::TextDisabled("last switch %.2f ms", shaderLibrary.lastSwitchMs());
+        if (shaderLibrary.reloadingCount() > 0)
+            ImGui::TextDisabled("%d shaders reloading", shaderLibrary.reloadingCount());
+        ImGui::TextDisabled("%.2f ms/frame, CPU %.2f ms", 1000.0f / io.Framerate, cpuFrameMs);
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        // GPU time per pass over the last few seconds, hover a pass for more percentiles
+        ImGui::Text("GPU Passes");
+        ImGui::Spacing();
+        if (sweepStep >= 0)
+            ImGui::BeginDisabled(); // the forward vs deferred sweep needs them
+        ImGui::Checkbox("Timer Queries", &gpuProfiler.enabled);
+        if (sweepStep >= 0)
+            ImGui::EndDisabled();
+        ImGui::TextDisabled("%-7s %6s %6s", "ms", "avg", "p95");
+        for (int pass = 0; pass < gpuProfiler.passCount(); pass++)
+        {
+            ImGui::TextDisabled("%-7s %6.3f %6.3f", gpuProfiler.passName(pass).c_str(), gpuProfiler.averageMs(pass), gpuProfiler.percentileMs(pass, 0.95f));
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("%s: p50 %.3f ms, p99 %.3f ms, max %.3f ms (%d frames)", gpuProfiler.passName(pass).c_str(), gpuProfiler.percentileMs(pass, 0.5f),
+                    gpuProfiler.percentileMs(pass, 0.99f), gpuProfiler.percentileMs(pass, 1.0f), gpuProfiler.sampleCount(pass));
+        }
+        ImGui::TextDisabled("%-7s %6.3f", "Total", gpuProfiler.totalMs());
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        // state changes made and dropped by the state cache last frame
+        ImGui::Text("GL State Calls");
+        ImGui::Spacing();
+        ImGui::TextDisabled("%-7s %6s %6s", "", "issued", "elided");
+        int issuedCalls = 0, elidedCalls = 0;
+        for (int call = 0; call < STATE_CALL_COUNT; call++)
+        {
+            GlStateCall kind = static_cast<GlStateCall>(call);
+            ImGui::TextDisabled("%-7s %6d %6d", GlState::callName(kind), GlState::get().issuedCount(kind), GlState::get().elidedCount(kind));
+            issuedCalls += GlState::get().issuedCount(kind);
+            elidedCalls += GlState::get().elidedCount(kind);
+        }
+        ImGui::TextDisabled("%-7s %6d %6d", "Total", issuedCalls, elidedCalls);
+        const RenderQueue::Stats& queueStats = renderQueue.lastFrameStats();
+        ImGui::TextDisabled("%d draws, %d programs, %d materials, %d VAOs", queueStats.draws, queueStats.programSwitches, queueStats.materialSwitches, queueStats.vertexArraySwitches);
         ImGui::Spacing();
         ImGui::Spacing();
 
@@ -446,12 +921,19 @@ int main()
 
         ImGui::Text("Model Shader");
         ImGui::Spacing();
+        if (deferredShading)
+            ImGui::TextDisabled("deferred shading is always Blinn-Phong");
         if (ImGui::Combo("##ModelShader", &currentModelShaderIndex, modelShaderNames, IM_ARRAYSIZE(modelShaderNames)))
         {
-            // Shader selection changed, reload the shader
-            delete modelShader;
-            modelShader = new Shader("Shaders/model/model.v", modelShaderPaths[currentModelShaderIndex]);
-            std::cout << "Switched to model shader: " << modelShaderNames[currentModelShaderIndex] << std::endl;
+            // Shader selection changed, swap in the prebuilt shader
+            activeModelShaderId = modelShaderIds[currentModelShaderIndex];
+            modelShader = shaderLibrary.get(activeModelShaderId);
+            std::cout << "Switched to model shader: " << modelShaderNames[currentModelShaderIndex] << " in " << shaderLibrary.lastSwitchMs() << " ms" << std::endl;
+        }
+        if (currentModelShaderIndex == 3 && ImGui::SliderInt("Levels##CellShading", &shadingLevels, 2, 8))
+        {
+            modelShaderIds[3] = shaderLibrary.add("Shaders/model/model.v", modelShaderPaths[3], modelShaderDefines(3, false));
+            instancedShaderIds[3] = shaderLibrary.add("Shaders/model/model.v", modelShaderPaths[3], modelShaderDefines(3, true));
         }
         ImGui::Spacing();
         ImGui::Spacing();
@@ -463,16 +945,90 @@ int main()
         int previousShaderIndex = currentShaderIndex;
         if (ImGui::Combo("##Post-Processing", &currentShaderIndex, shaderNames, IM_ARRAYSIZE(shaderNames)))
         {
-            // Shader selection changed, reload the shader
-            delete screenShader;
-            screenShader = new Shader("shaders/postProcessing/screen.v", shaderPaths[currentShaderIndex]);
+            // Shader selection changed, swap in the prebuilt shader
+            activeScreenShaderId = screenShaderIds[currentShaderIndex];
+            screenShader = shaderLibrary.get(activeScreenShaderId);
             screenShader->use();
             screenShader->setInt("screenTexture", 0);
-            std::cout << "Switched to shader: " << shaderNames[currentShaderIndex] << std::endl;
+            std::cout << "Switched to shader: " << shaderNames[currentShaderIndex] << " in " << shaderLibrary.lastSwitchMs() << " ms" << std::endl;
+        }
+        bool screenKnobChanged = false;
+        if (currentShaderIndex == 2)
+        {
+            screenKnobChanged |= ImGui::SliderFloat("Pixel Size##Dithering", &ditherSize, 1.0f, 8.0f, "%.0f");
+            screenKnobChanged |= ImGui::SliderInt("Gray Levels##Dithering", &bitDepth, 2, 16);
+        }
+        else if (currentShaderIndex == 3)
+            screenKnobChanged |= ImGui::SliderFloat("Strength##Gaussian", &blurStrength, 1.0f, 10.0f, "%.0f");
+        else if (currentShaderIndex == 4)
+            screenKnobChanged |= ImGui::SliderInt("Radius##Kuwahara", &kuwaharaRadius, 1, 6);
+        else if (currentShaderIndex == 7)
+            screenKnobChanged |= ImGui::SliderFloat("Cells##Worley", &worleyScale, 10.0f, 200.0f, "%.0f");
+        if (screenKnobChanged)
+        {
+            // whole steps only, so dragging a slider visits a handful of variants instead of one per pixel
+            ditherSize = std::round(ditherSize);
+            blurStrength = std::round(blurStrength);
+            worleyScale = std::round(worleyScale / 10.0f) * 10.0f;
+            screenShaderIds[currentShaderIndex] = shaderLibrary.add("shaders/postProcessing/screen.v", shaderPaths[currentShaderIndex], screenShaderDefines(currentShaderIndex));
+        }
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        // Forward or deferred, with what the G-buffer costs in memory and traffic
+        ImGui::Text("Shading");
+        ImGui::Spacing();
+        if (sweepStep >= 0)
+            ImGui::BeginDisabled(); // set by the forward vs deferred sweep
+        ImGui::Checkbox("Deferred", &deferredShading);
+        if (sweepStep >= 0)
+            ImGui::EndDisabled();
+        ImGui::TextDisabled("G-buffer %.1f MB, %d B/px", gBuffer.bytes() / (1024.0f * 1024.0f), GBuffer::BYTES_PER_PIXEL);
+        if (deferredShading)
+            ImGui::TextDisabled(">= %.1f MB/frame, %.2f GB/s", gBuffer.frameTrafficBytes() / (1024.0f * 1024.0f), gBuffer.frameTrafficBytes() * io.Framerate / 1e9f);
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        // Stress scene
+        ImGui::Text("Stress Scene");
+        ImGui::Spacing();
+        ImGui::Combo("##StressScene", &stressSceneIndex, stressSceneNames, IM_ARRAYSIZE(stressSceneNames));
+        ImGui::Checkbox("Instanced", &stressInstanced);
+        ImGui::Checkbox("Frustum Culling", &frustumCulling);
+        ImGui::TextDisabled("%zu of %zu objects visible, culled in %.3f ms (%s)", visibleObjects.size(), sceneBounds.size(), cullMs, CullingSet::simdName());
+        ImGui::TextDisabled("scene graph: %zu nodes, %zu updated", sceneGraph.size(), sceneNodesUpdated);
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        // Clustered point lights, with the CPU time of each stage
+        ImGui::Text("Point Lights");
+        ImGui::Spacing();
+        if (sweepStep >= 0)
+            ImGui::BeginDisabled(); // set by the forward vs deferred sweep
+        ImGui::Combo("##PointLights", &pointLightIndex, pointLightNames, IM_ARRAYSIZE(pointLightNames));
+        if (sweepStep >= 0)
+            ImGui::EndDisabled();
+        ImGui::SliderFloat("##PointLightRadius", &pointLightRadius, 0.1f, 2.0f, "radius %.2f");
+        ImGui::SliderFloat("##PointLightIntensity", &pointLightIntensity, 0.1f, 4.0f, "intensity %.1f");
+        if (lightClusters.lightCount() > 0)
+        {
+            const LightClusters::Timings& lightTimings = lightClusters.timings();
+            ImGui::TextDisabled("setup %.3f, bin %.3f ms (%s)", lightTimings.setupMs, lightTimings.binMs, LightClusters::simdName());
+            ImGui::TextDisabled("compact %.3f, upload %.3f ms", lightTimings.compactMs, lightTimings.uploadMs);
+            ImGui::TextDisabled("%zu indices, max %u per cluster", lightClusters.indexCount(), lightClusters.maxClusterLights());
         }
         ImGui::Spacing();
         ImGui::Spacing();
 
+        // LOD selection
+        ImGui::Text("Level of Detail");
+        ImGui::Spacing();
+        ImGui::Checkbox("Auto LOD", &autoLod);
+        ImGui::SliderFloat("##LodPixelError", &lodPixelError, 0.25f, 8.0f, "%.2f px error");
+        ImGui::Checkbox("LOD Overlay", &showLodOverlay);
+        ImGui::Spacing();
+        ImGui::Spacing();
+
         // Camera auto-spin toggle
         ImGui::Text("Camera Auto-Spin");
         ImGui::Spacing();
@@ -523,31 +1079,164 @@ int main()
         ImGui::Text("Light Color");
         ImGui::Spacing();
         ImGui::ColorPicker3("##LightColor", lightColor, ImGuiColorEditFlags_PickerHueBar | ImGuiColorEditFlags_NoSidePreview | ImGuiColorEditFlags_NoSmallPreview | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoLabel);
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        // Benchmarks, run in the background and print to the console as well
+        ImGui::Text("Benchmarks");
+        ImGui::Spacing();
+        bool benchmarkRunning = benchmarkLog.running;
+        if (benchmarkRunning)
+            ImGui::BeginDisabled();
+        if (ImGui::Button("OBJ Parser vs Assimp"))
+        {
+            benchmarkLog.clear();
+            benchmarkLog.running = true;
+            std::vector<std::string> paths(std::begin(modelPaths), std::end(modelPaths));
+            paths.push_back("resources/sphere.obj");
+            workerPool.submit([paths, &workerPool, &benchmarkLog]
+            {
+                benchmarkObjParser(paths, workerPool, benchmarkLog);
+                benchmarkLog.running = false;
+            });
+        }
+        if (ImGui::Button("Uniform Setters"))
+            runUniformBenchmark = true;
+        if (ImGui::Button("Render Queue Sort"))
+        {
+            benchmarkLog.clear();
+            benchmarkLog.running = true;
+            workerPool.submit([&benchmarkLog]
+            {
+                benchmarkRenderQueueSort(benchmarkLog);
+                benchmarkLog.running = false;
+            });
+        }
+        if (ImGui::Button("Frustum Culling"))
+        {
+            benchmarkLog.clear();
+            benchmarkLog.running = true;
+            workerPool.submit([&benchmarkLog]
+            {
+                benchmarkFrustumCulling(benchmarkLog);
+                benchmarkLog.running = false;
+            });
+        }
+        if (ImGui::Button("Scene Graph Update"))
+        {
+            benchmarkLog.clear();
+            benchmarkLog.running = true;
+            workerPool.submit([&benchmarkLog]
+            {
+                benchmarkSceneGraph(benchmarkLog);
+                benchmarkLog.running = false;
+            });
+        }
+        if (ImGui::Button("Light Clusters"))
+        {
+            benchmarkLog.clear();
+            benchmarkLog.running = true;
+            workerPool.submit([&workerPool, &benchmarkLog]
+            {
+                benchmarkLightClusters(workerPool, benchmarkLog);
+                benchmarkLog.running = false;
+            });
+        }
+        if (ImGui::Button("Forward vs Deferred"))
+        {
+            // renders, so it runs in the frame loop, a step every few seconds
+            benchmarkLog.clear();
+            benchmarkLog.running = true;
+            char line[160];
+            snprintf(line, sizeof(line), "%dx%d, G-buffer %d B/px, >= %.1f MB/frame", gBuffer.width(), gBuffer.height(), GBuffer::BYTES_PER_PIXEL,
+                gBuffer.frameTrafficBytes() / (1024.0f * 1024.0f));
+            benchmarkLog.add(line);
+            sweepRestoreDeferred = deferredShading;
+            sweepRestorePointLights = pointLightIndex;
+            sweepRestoreTimerQueries = gpuProfiler.enabled;
+            gpuProfiler.enabled = true;
+            sweepStep = 0;
+            sweepFrame = 0;
+        }
+        if (benchmarkRunning)
+        {
+            ImGui::EndDisabled();
+            ImGui::TextDisabled("Running...");
+        }
+        for (const std::string& line : benchmarkLog.snapshot())
+            ImGui::TextDisabled("%s", line.c_str());
 
         ImGui::End();
 
+        // LOD debug overlay: the chosen level next to every model drawn this frame
+        if (showLodOverlay)
+        {
+            ImDrawList* overlay = ImGui::GetForegroundDrawList();
+            for (const LodLabel& label : lodLabels)
+            {
+                char text[64];
+                snprintf(text, sizeof(text), "LOD %d\n%d tris\n%.0f px", label.lod, label.triangles, label.radius);
+                overlay->AddCircle(label.screenPosition, label.radius, IM_COL32(255, 220, 0, 160));
+                overlay->AddText(label.screenPosition, IM_COL32(255, 220, 0, 255), text);
+            }
+        }
+
         // imgui draw
         ImGui::Render();
+        gpuProfiler.begin(imguiPass);
+        // the backend restores the bindings and enable bits it changes, so GlState stays in sync
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        gpuProfiler.end();
 
 
+        cpuFrameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cpuFrameStart).count();
+
+        if (sweepStep >= 0 && ++sweepFrame > SWEEP_SETTLE_FRAMES)
+        {
+            if (sweepFrame == SWEEP_SETTLE_FRAMES + 1)
+            {
+                gpuProfiler.reset();
+                sweepCpuMs = 0.0f;
+            }
+            sweepCpuMs += cpuFrameMs;
+            if (sweepFrame == SWEEP_SETTLE_FRAMES + SWEEP_FRAMES)
+            {
+                const ShadingSweepStep& step = shadingSweep[sweepStep];
+                char line[160];
+                snprintf(line, sizeof(line), "%-8s %6s lights: GPU %.3f ms (scene %.3f, lights %.3f), CPU %.3f ms", step.deferred ? "deferred" : "forward", step.lights,
+                    gpuProfiler.totalMs(), gpuProfiler.averageMs(scenePass), gpuProfiler.averageMs(lightingPass), sweepCpuMs / SWEEP_FRAMES);
+                benchmarkLog.add(line);
+                sweepFrame = 0;
+                if (++sweepStep == IM_ARRAYSIZE(shadingSweep))
+                {
+                    sweepStep = -1;
+                    deferredShading = sweepRestoreDeferred;
+                    pointLightIndex = sweepRestorePointLights;
+                    gpuProfiler.enabled = sweepRestoreTimerQueries;
+                    benchmarkLog.running = false;
+                }
+            }
+        }
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
-    glDeleteVertexArrays(1, &cubeVAO);
-    glDeleteVertexArrays(1, &planeVAO);
-    glDeleteVertexArrays(1, &quadVAO);
-    glDeleteBuffers(1, &cubeVBO);
-    glDeleteBuffers(1, &planeVBO);
-    glDeleteBuffers(1, &quadVBO);
+    stressInstances.release();
+    for (SceneObject& object : sceneObjects)
+        object.instance.release();
+    staticGeometry.release();
+    gpuProfiler.release();
+    cameraUniforms.release();
+    lightUniforms.release();
+    clusterUniforms.release();
+    lightClusters.release();
+    gBuffer.release();
     glDeleteRenderbuffers(1, &rbo);
     glDeleteFramebuffers(1, &framebuffer);
 
-    delete screenShader;
-    delete modelShader;
     delete ourModel;
     delete lightModel;
+    TextureCache::get().release(floorTexture);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -581,43 +1270,4 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
-}
-
-// utility function for loading a 2D texture from file
-// ---------------------------------------------------
-unsigned int loadTexture(char const* path)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
 }
\ No newline at end of file
@@ -5,9 +5,16 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
+#include "bounds.h"
+#include "geometryArena.h"
 #include "shader_s.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 using namespace std;
@@ -31,33 +38,236 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// vertex layouts a mesh can be uploaded with, selectable per model
+enum VertexFormat {
+    VERTEX_FORMAT_FULL,   // Vertex as is, 88 bytes
+    VERTEX_FORMAT_PACKED  // PackedVertex, 20 bytes
+};
+
+// compact vertex: position quantized to 16 bits inside the mesh bounds, octahedral normal and tangent, half-float UVs.
+// The bitangent is rebuilt from normal, tangent and the sign in Position[3]. Bone data is dropped, nothing here is skinned.
+struct PackedVertex {
+    uint16_t Position[4];   // unorm16 relative to the mesh AABB, w = bitangent sign (0 = -1, 65535 = +1)
+    int16_t  Normal[2];     // octahedral encoding, snorm16
+    int16_t  Tangent[2];    // octahedral encoding, snorm16
+    uint16_t TexCoords[2];  // half floats, UVs may tile outside [0, 1]
+};
+
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// a simplified version of a mesh: a range of MeshData::lodIndices, drawn with the mesh's vertices
+struct MeshLod {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    float        error;      // largest distance a surface point moved, in object space
+};
+
+// CPU-side mesh data. Either owns its arrays (fresh import) or views memory owned elsewhere (a memory-mapped mesh cache entry).
+struct MeshData {
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<Texture>      textures; // type and path only, the texture ids are resolved on upload
+    // set when viewing external memory instead of the vectors above
+    const Vertex*        mappedVertices = nullptr;
+    const unsigned int*  mappedIndices = nullptr;
+    size_t               mappedVertexCount = 0;
+    size_t               mappedIndexCount = 0;
+
+    // LOD 1..n from generateLods, coarsest last. The index lists of all levels are concatenated.
+    vector<MeshLod>      lods;
+    vector<unsigned int> lodIndices;
+    const unsigned int*  mappedLodIndices = nullptr;
+
+    // filled by packVertices for models that use VERTEX_FORMAT_PACKED
+    vector<PackedVertex> packedVertices;
+
+    Bounds               bounds; // of the full vertices, set after loading
+
+    const Vertex* vertexData() const { return mappedVertices ? mappedVertices : vertices.data(); }
+    size_t vertexCount() const { return mappedVertices ? mappedVertexCount : vertices.size(); }
+    const unsigned int* indexData() const { return mappedIndices ? mappedIndices : indices.data(); }
+    size_t indexCount() const { return mappedIndices ? mappedIndexCount : indices.size(); }
+    const unsigned int* lodIndexData() const { return mappedLodIndices ? mappedLodIndices : lodIndices.data(); }
+};
+
+// a node of an imported hierarchy: its transform relative to its parent and the meshes drawn with it. Nodes are stored
+// parents first. A node's meshes are a run of the model's list of mesh references, several nodes can reference the
+// same mesh.
+struct ModelNode {
+    int          parent = -1; // index of an earlier node, -1 for the root
+    glm::vec3    position = glm::vec3(0.0f);
+    glm::quat    rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3    scale = glm::vec3(1.0f);
+    unsigned int firstMesh = 0;
+    unsigned int meshCount = 0;
+};
+
+// IEEE half float conversion with round-to-nearest, values too large for a half become infinity
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int32_t exponent = int32_t((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+    if (((bits >> 23) & 0xFF) == 0xFF) // inf / nan
+        return uint16_t(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+    if (exponent >= 31)
+        return uint16_t(sign | 0x7C00u);
+    if (exponent <= 0) // denormal or zero
+    {
+        if (exponent < -10)
+            return uint16_t(sign);
+        mantissa |= 0x800000u;
+        uint32_t shift = uint32_t(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1u)
+            half++;
+        return uint16_t(sign | half);
+    }
+    uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000u) // round, a carry into the exponent is still correct
+        half++;
+    return uint16_t(half);
+}
+
+// octahedral unit vector encoding (Meyer et al.), stored as two snorm16 values
+inline void octahedralEncode(glm::vec3 n, int16_t out[2])
+{
+    float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float x = 0.0f, y = 0.0f;
+    if (sum > 0.0f)
+    {
+        x = n.x / sum;
+        y = n.y / sum;
+        if (n.z < 0.0f)
+        {
+            float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = foldedX;
+            y = foldedY;
+        }
+    }
+    out[0] = int16_t(lroundf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f));
+    out[1] = int16_t(lroundf(fminf(fmaxf(y, -1.0f), 1.0f) * 32767.0f));
+}
+
+// fills data.packedVertices from the full vertices, quantizing positions inside the given box (minimum and extent).
+// All meshes of a model share one box so the whole model decodes with the same uniforms.
+inline void packVertices(MeshData& data, glm::vec3 minimum, glm::vec3 extent)
+{
+    const Vertex* vertices = data.vertexData();
+    size_t count = data.vertexCount();
+    data.packedVertices.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const Vertex& vertex = vertices[i];
+        PackedVertex& packed = data.packedVertices[i];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t = extent[axis] > 0.0f ? (vertex.Position[axis] - minimum[axis]) / extent[axis] : 0.0f;
+            packed.Position[axis] = uint16_t(lroundf(fminf(fmaxf(t, 0.0f), 1.0f) * 65535.0f));
+        }
+        bool rightHanded = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) >= 0.0f;
+        packed.Position[3] = rightHanded ? 65535 : 0;
+        octahedralEncode(vertex.Normal, packed.Normal);
+        octahedralEncode(vertex.Tangent, packed.Tangent);
+        packed.TexCoords[0] = floatToHalf(vertex.TexCoords.x);
+        packed.TexCoords[1] = floatToHalf(vertex.TexCoords.y);
+    }
+}
+
+// vertex attribute setup for the full Vertex, called by GeometryArena on its VAO
+inline void setVertexAttributes(GLsizei stride)
+{
+    // set the vertex attribute pointers
+    // vertex Positions
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    // vertex normals
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+    // vertex texture coords
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+    // vertex tangent
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Tangent));
+    // vertex bitangent
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Bitangent));
+    // ids
+    glEnableVertexAttribArray(5);
+    glVertexAttribIPointer(5, 4, GL_INT, stride, (void*)offsetof(Vertex, m_BoneIDs));
+
+    // weights
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, m_Weights));
+}
+
+// same locations as the full layout, the normalized integer types are expanded to floats by the vertex fetch
+// and model.v finishes the decode (dequantize the position, unfold the octahedral normal)
+inline void setPackedVertexAttributes(GLsizei stride)
+{
+    // vertex Positions (xyz unorm16, w = bitangent sign)
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, Position));
+    // vertex normals (octahedral xy)
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, Normal));
+    // vertex texture coords
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, TexCoords));
+    // vertex tangent (octahedral xy)
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, Tangent));
+}
+
+inline GeometryArena::Layout vertexLayout(VertexFormat format)
+{
+    if (format == VERTEX_FORMAT_PACKED)
+        return { sizeof(PackedVertex), setPackedVertexAttributes };
+    return { sizeof(Vertex), setVertexAttributes };
+}
+
+// A mesh is a range of its model's GeometryArena plus the textures it is drawn with. It owns no GL objects.
 class Mesh {
 public:
     // mesh Data
-    vector<Vertex>       vertices;
-    vector<unsigned int> indices;
     vector<Texture>      textures;
-    unsigned int VAO;
+    vector<ArenaRange>   lodRanges; // LOD 0 is the full mesh
+    vector<float>        lodErrors;
+    Bounds               bounds;    // in model space
 
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor, appends the loaded mesh data and its LODs to the arena (packed vertices if the arena uses that layout)
+    Mesh(const MeshData& data, vector<Texture> textures, GeometryArena& arena, VertexFormat format)
     {
-        this->vertices = vertices;
-        this->indices = indices;
         this->textures = textures;
+        this->bounds = data.bounds;
+        if (format == VERTEX_FORMAT_PACKED)
+            lodRanges.push_back(arena.add(data.packedVertices.data(), data.packedVertices.size(), data.indexData(), data.indexCount()));
+        else
+            lodRanges.push_back(arena.add(data.vertexData(), data.vertexCount(), data.indexData(), data.indexCount()));
+        lodErrors.push_back(0.0f);
+        for (const MeshLod& lod : data.lods)
+        {
+            lodRanges.push_back(arena.addIndices(lodRanges[0], data.lodIndexData() + lod.firstIndex, lod.indexCount));
+            lodErrors.push_back(lod.error);
+        }
+    }
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+    // the range to draw for a model LOD, meshes with fewer levels use their coarsest one
+    const ArenaRange& lodRange(size_t lod) const
+    {
+        return lodRanges[std::min(lod, lodRanges.size() - 1)];
     }
 
-    // render the mesh
-    void Draw(Shader& shader)
+    // binds the textures to consecutive units and points the texture_diffuseN/... samplers at them
+    void bindTextures(Shader& shader) const
     {
         // bind appropriate textures
         unsigned int diffuseNr = 1;
@@ -66,7 +276,6 @@ public:
         unsigned int heightNr = 1;
         for (unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -80,67 +289,21 @@ public:
                 number = std::to_string(heightNr++); // transfer unsigned int to string
 
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            shader.setInt(name + number, i);
+            // and finally bind the texture, unless the unit still has it from the last draw
+            GlState::get().bindTexture(i, GL_TEXTURE_2D, textures[i].id);
         }
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    // render data 
-    unsigned int VBO, EBO;
-
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // whether two meshes can go into the same multi-draw
+    bool sameTextures(const Mesh& other) const
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-        // ids
-        glEnableVertexAttribArray(5);
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
-
-        // weights
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+        if (textures.size() != other.textures.size())
+            return false;
+        for (size_t i = 0; i < textures.size(); i++)
+            if (textures[i].id != other.textures[i].id || textures[i].type != other.textures[i].type)
+                return false;
+        return true;
     }
 };
 #endif#pragma once
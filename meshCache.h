@@ -0,0 +1,489 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "hash.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read-only memory mapping of a whole file. The mapping lives as long as the object.
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close();
+            return false;
+        }
+        void* ptr = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(ptr);
+        length = static_cast<size_t>(st.st_size);
+#endif
+        if (!bytes)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes)
+            munmap(const_cast<unsigned char*>(bytes), length);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+// On-disk cache of the final Vertex/index arrays of every mesh in a model, so repeat loads can skip Assimp entirely.
+// Files live in cache/meshes/ and are named after the source hash and the post-process flags used to import it. The
+// source hash covers the file and, for .obj files, the .mtl libraries it references, since the cached texture paths come
+// from those.
+// Layout: MeshCacheHeader, MeshCacheEntry[meshCount], ModelNode[nodeCount], the mesh references of the nodes
+// (uint32_t[nodeMeshCount]), then a data blob holding texture records, vertices, indices and LODs.
+class MeshCache
+{
+public:
+    // bump whenever the file layout or the meaning of the cached data changes
+    static const uint32_t VERSION = 5; // 2: meshes are welded and cache optimized, 3: LOD index lists, 4: node hierarchy, 5: shared meshes
+
+    uint64_t sourceHash = 0;
+    unsigned int postProcessFlags = 0;
+
+    // hashes the source file and maps its cache entry if there is a valid one. Returns false on a cache miss.
+    bool open(const string& sourcePath, unsigned int flags)
+    {
+        postProcessFlags = flags;
+        {
+            MappedFile source;
+            if (!source.open(sourcePath))
+                return false;
+            sourceHash = hashBytes(source.data(), source.size());
+            bool isObj = sourcePath.size() > 4 && sourcePath.compare(sourcePath.size() - 4, 4, ".obj") == 0;
+            if (isObj)
+                sourceHash = hashMaterialLibraries(source, sourcePath, sourceHash);
+        }
+
+        if (!file.open(cachePath()))
+            return false;
+        if (file.size() < sizeof(MeshCacheHeader))
+            return invalidate();
+        memcpy(&header, file.data(), sizeof(MeshCacheHeader));
+        if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION || header.vertexSize != sizeof(Vertex)
+            || header.nodeSize != sizeof(ModelNode) || header.sourceHash != sourceHash || header.postProcessFlags != postProcessFlags)
+            return invalidate();
+        if (blobOffset() > file.size() || header.blobSize > file.size() - blobOffset())
+            return invalidate();
+        if (!validate())
+        {
+            std::cout << "ERROR::MESH_CACHE::CORRUPT_ENTRY: " << cachePath() << ", rebuilding it" << std::endl;
+            return invalidate();
+        }
+        return true;
+    }
+
+    unsigned int meshCount() const { return header.meshCount; }
+    unsigned int nodeCount() const { return header.nodeCount; }
+    unsigned int nodeMeshCount() const { return header.nodeMeshCount; }
+
+    ModelNode node(unsigned int index) const
+    {
+        ModelNode node;
+        memcpy(&node, file.data() + sizeof(MeshCacheHeader) + header.meshCount * sizeof(MeshCacheEntry) + index * sizeof(ModelNode), sizeof(ModelNode));
+        return node;
+    }
+
+    // the index of the mesh behind a node's mesh reference
+    unsigned int nodeMesh(unsigned int index) const
+    {
+        uint32_t mesh;
+        memcpy(&mesh, file.data() + nodeMeshOffset() + index * sizeof(uint32_t), sizeof(uint32_t));
+        return mesh;
+    }
+
+    // how long the import (OBJ parser or Assimp) that produced this entry took, for comparison with the cached load
+    float importMs() const { return header.importMs; }
+
+    // view of one mesh inside the mapped file. The vertex and index pointers stay valid while the MeshCache is open.
+    MeshData mesh(unsigned int index) const
+    {
+        MeshCacheEntry entry;
+        memcpy(&entry, file.data() + sizeof(MeshCacheHeader) + index * sizeof(MeshCacheEntry), sizeof(MeshCacheEntry));
+        const unsigned char* blob = file.data() + blobOffset();
+
+        MeshData mesh;
+        mesh.mappedVertices = reinterpret_cast<const Vertex*>(blob + entry.vertexOffset);
+        mesh.mappedVertexCount = entry.vertexCount;
+        mesh.mappedIndices = reinterpret_cast<const unsigned int*>(blob + entry.indexOffset);
+        mesh.mappedIndexCount = entry.indexCount;
+        mesh.lods.resize(entry.lodCount);
+        if (entry.lodCount > 0)
+            memcpy(mesh.lods.data(), blob + entry.lodOffset, entry.lodCount * sizeof(MeshLod));
+        mesh.mappedLodIndices = reinterpret_cast<const unsigned int*>(blob + entry.lodIndexOffset);
+
+        const unsigned char* record = blob + entry.textureOffset;
+        for (unsigned int i = 0; i < entry.textureCount; i++)
+        {
+            uint16_t typeLength, pathLength;
+            memcpy(&typeLength, record, sizeof(uint16_t));
+            memcpy(&pathLength, record + sizeof(uint16_t), sizeof(uint16_t));
+            record += 2 * sizeof(uint16_t);
+            Texture texture;
+            texture.id = 0;
+            texture.type.assign(reinterpret_cast<const char*>(record), typeLength);
+            texture.path.assign(reinterpret_cast<const char*>(record + typeLength), pathLength);
+            record += typeLength + pathLength;
+            mesh.textures.push_back(texture);
+        }
+        return mesh;
+    }
+
+    // writes a cache entry for the meshes and nodes that were just imported. open() must have been called first to hash the source.
+    bool write(const vector<MeshData>& meshes, const vector<ModelNode>& nodes, const vector<unsigned int>& nodeMeshes, float importMs) const
+    {
+        MeshCacheHeader out = {};
+        memcpy(out.magic, MAGIC, sizeof(out.magic));
+        out.version = VERSION;
+        out.vertexSize = sizeof(Vertex);
+        out.nodeSize = sizeof(ModelNode);
+        out.sourceHash = sourceHash;
+        out.postProcessFlags = postProcessFlags;
+        out.meshCount = static_cast<uint32_t>(meshes.size());
+        out.nodeCount = static_cast<uint32_t>(nodes.size());
+        out.nodeMeshCount = static_cast<uint32_t>(nodeMeshes.size());
+        out.importMs = importMs;
+
+        // lay out the blob: texture records first, then 16 byte aligned vertex and index arrays per mesh
+        vector<MeshCacheEntry> entries(meshes.size());
+        vector<unsigned char> blob;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const MeshData& mesh = meshes[i];
+            MeshCacheEntry& entry = entries[i];
+            entry.textureOffset = blob.size();
+            entry.textureCount = static_cast<uint32_t>(mesh.textures.size());
+            for (const Texture& texture : mesh.textures)
+            {
+                uint16_t lengths[2] = { static_cast<uint16_t>(texture.type.size()), static_cast<uint16_t>(texture.path.size()) };
+                append(blob, lengths, sizeof(lengths));
+                append(blob, texture.type.data(), texture.type.size());
+                append(blob, texture.path.data(), texture.path.size());
+            }
+            align(blob);
+            entry.vertexOffset = blob.size();
+            entry.vertexCount = static_cast<uint32_t>(mesh.vertexCount());
+            append(blob, mesh.vertexData(), mesh.vertexCount() * sizeof(Vertex));
+            align(blob);
+            entry.indexOffset = blob.size();
+            entry.indexCount = static_cast<uint32_t>(mesh.indexCount());
+            append(blob, mesh.indexData(), mesh.indexCount() * sizeof(unsigned int));
+            align(blob);
+            entry.lodOffset = blob.size();
+            entry.lodCount = static_cast<uint32_t>(mesh.lods.size());
+            append(blob, mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+            align(blob);
+            entry.lodIndexOffset = blob.size();
+            size_t lodIndexCount = mesh.lods.empty() ? 0 : mesh.lods.back().firstIndex + mesh.lods.back().indexCount;
+            append(blob, mesh.lodIndexData(), lodIndexCount * sizeof(unsigned int));
+        }
+        out.blobSize = blob.size();
+
+        // write to a per-thread temporary file and move it into place, so a crash never leaves a truncated entry
+        // behind and two loaders importing the same model don't write into each other's file
+        std::error_code error;
+        std::filesystem::create_directories(CACHE_DIRECTORY, error);
+        string path = cachePath();
+        string tempPath = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        {
+            std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+            if (!stream)
+            {
+                std::cout << "ERROR::MESH_CACHE::COULD_NOT_WRITE: " << tempPath << std::endl;
+                return false;
+            }
+            stream.write(reinterpret_cast<const char*>(&out), sizeof(out));
+            stream.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+            stream.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(ModelNode));
+            for (unsigned int mesh : nodeMeshes)
+            {
+                uint32_t index = mesh;
+                stream.write(reinterpret_cast<const char*>(&index), sizeof(index));
+            }
+            const char padding[16] = {};
+            stream.write(padding, blobOffset(out) - (nodeMeshOffset(out) + nodeMeshes.size() * sizeof(uint32_t)));
+            stream.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+            if (!stream)
+                return false;
+        }
+        std::filesystem::rename(tempPath, path, error);
+        if (error)
+        {
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr const char* CACHE_DIRECTORY = "cache/meshes";
+    static constexpr char MAGIC[4] = { 'S', 'D', 'M', 'C' };
+
+    struct MeshCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t vertexSize;
+        uint32_t postProcessFlags;
+        uint64_t sourceHash;
+        uint64_t blobSize;
+        uint32_t meshCount;
+        float importMs;
+        uint32_t nodeSize;
+        uint32_t nodeCount;
+        uint32_t nodeMeshCount;
+        uint32_t reserved;
+    };
+
+    struct MeshCacheEntry
+    {
+        uint64_t textureOffset;
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint64_t lodOffset;      // MeshLod[lodCount]
+        uint64_t lodIndexOffset; // index lists of all LODs, concatenated
+        uint32_t textureCount;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t lodCount;
+    };
+
+    MappedFile file;
+    MeshCacheHeader header = {};
+
+    string cachePath() const
+    {
+        std::stringstream name;
+        name << CACHE_DIRECTORY << '/' << std::hex << std::setfill('0') << std::setw(16) << sourceHash << '_' << std::setw(8) << postProcessFlags << ".bin";
+        return name.str();
+    }
+
+    // the blob starts 16 byte aligned, so the arrays aligned inside it are aligned in the mapping as well
+    size_t blobOffset() const
+    {
+        return blobOffset(header);
+    }
+
+    static size_t blobOffset(const MeshCacheHeader& header)
+    {
+        size_t offset = nodeMeshOffset(header) + header.nodeMeshCount * sizeof(uint32_t);
+        return (offset + 15) & ~size_t(15);
+    }
+
+    size_t nodeMeshOffset() const
+    {
+        return nodeMeshOffset(header);
+    }
+
+    static size_t nodeMeshOffset(const MeshCacheHeader& header)
+    {
+        return sizeof(MeshCacheHeader) + header.meshCount * sizeof(MeshCacheEntry) + header.nodeCount * sizeof(ModelNode);
+    }
+
+    // mixes the name and the bytes of every mtllib the .obj references into hash. A library that is missing still adds
+    // its name, so creating it later changes the hash as well.
+    static uint64_t hashMaterialLibraries(const MappedFile& source, const string& sourcePath, uint64_t hash)
+    {
+        size_t slash = sourcePath.find_last_of('/');
+        string directory = slash == string::npos ? string(".") : sourcePath.substr(0, slash);
+        const char* p = reinterpret_cast<const char*>(source.data());
+        const char* end = p + source.size();
+        while (p < end)
+        {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!lineEnd)
+                lineEnd = end;
+            while (p < lineEnd && (*p == ' ' || *p == '\t'))
+                p++;
+            if (lineEnd - p > 6 && strncmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))
+            {
+                // the rest of the line, trimmed the way the OBJ parser reads it
+                const char* name = p + 6;
+                const char* nameEnd = lineEnd;
+                while (name < nameEnd && (*name == ' ' || *name == '\t'))
+                    name++;
+                while (nameEnd > name && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t' || nameEnd[-1] == '\r'))
+                    nameEnd--;
+                string library(name, nameEnd);
+                hash = hashBytes(library.data(), library.size(), hash);
+                MappedFile material;
+                if (material.open(directory + '/' + library))
+                    hash = hashBytes(material.data(), material.size(), hash);
+            }
+            p = lineEnd + 1;
+        }
+        return hash;
+    }
+
+    // whether [offset, offset + bytes) lies inside the blob, without overflowing on garbage offsets
+    bool inBlob(uint64_t offset, uint64_t bytes) const
+    {
+        return offset <= header.blobSize && bytes <= header.blobSize - offset;
+    }
+
+    // checks every offset, count and index the accessors follow against the mapped file, so a torn write or a
+    // corrupted file is a cache miss rather than a read past the mapping
+    bool validate() const
+    {
+        for (unsigned int i = 0; i < header.meshCount; i++)
+        {
+            MeshCacheEntry entry;
+            memcpy(&entry, file.data() + sizeof(MeshCacheHeader) + i * sizeof(MeshCacheEntry), sizeof(MeshCacheEntry));
+            if (!inBlob(entry.vertexOffset, uint64_t(entry.vertexCount) * sizeof(Vertex))
+                || !inBlob(entry.indexOffset, uint64_t(entry.indexCount) * sizeof(unsigned int))
+                || !inBlob(entry.lodOffset, uint64_t(entry.lodCount) * sizeof(MeshLod)))
+                return false;
+            const unsigned char* blob = file.data() + blobOffset();
+            uint64_t lodIndexCount = 0;
+            for (unsigned int lod = 0; lod < entry.lodCount; lod++)
+            {
+                MeshLod level;
+                memcpy(&level, blob + entry.lodOffset + lod * sizeof(MeshLod), sizeof(MeshLod));
+                lodIndexCount = std::max(lodIndexCount, uint64_t(level.firstIndex) + level.indexCount);
+            }
+            if (!inBlob(entry.lodIndexOffset, lodIndexCount * sizeof(unsigned int)))
+                return false;
+            uint64_t record = entry.textureOffset;
+            for (unsigned int texture = 0; texture < entry.textureCount; texture++)
+            {
+                uint16_t lengths[2];
+                if (!inBlob(record, sizeof(lengths)))
+                    return false;
+                memcpy(lengths, blob + record, sizeof(lengths));
+                record += sizeof(lengths);
+                if (!inBlob(record, uint64_t(lengths[0]) + lengths[1]))
+                    return false;
+                record += lengths[0] + lengths[1];
+            }
+        }
+        for (unsigned int i = 0; i < header.nodeCount; i++)
+        {
+            ModelNode modelNode = node(i);
+            if (modelNode.parent >= static_cast<int>(i) || modelNode.parent < -1
+                || uint64_t(modelNode.firstMesh) + modelNode.meshCount > header.nodeMeshCount)
+                return false;
+        }
+        for (unsigned int i = 0; i < header.nodeMeshCount; i++)
+            if (nodeMesh(i) >= header.meshCount)
+                return false;
+        return true;
+    }
+
+    bool invalidate()
+    {
+        file.close();
+        header = {};
+        return false;
+    }
+
+    static void append(vector<unsigned char>& blob, const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        blob.insert(blob.end(), bytes, bytes + size);
+    }
+
+    static void align(vector<unsigned char>& blob)
+    {
+        blob.resize((blob.size() + 15) & ~size_t(15), 0);
+    }
+};
+#endif
@@ -0,0 +1,367 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Load-time optimizations for indexed triangle meshes, run once after import (the mesh cache stores the result):
+//   1. weldVertices          merges bitwise identical vertices, OBJ files come out of Assimp with one vertex per face corner
+//   2. optimizeVertexCache   reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+//   3. optimizeOverdraw      reorders clusters of those triangles so outward facing ones come first (front-to-back-ish)
+//   4. optimizeVertexFetch   reorders the vertex buffer into first-use order so fetches walk memory linearly
+// analyzeVertexCache measures the result against a simulated FIFO cache.
+
+struct VertexCacheStats
+{
+    float acmr = 0.0f; // average cache miss ratio, transformed vertices per triangle (0.5 is the ideal for large grid meshes, 3 the worst)
+    float atvr = 0.0f; // average transformed vertex ratio, transformed vertices per unique vertex (1 is the ideal)
+};
+
+// simulates a FIFO post-transform cache of the given size over the index buffer
+inline VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 16)
+{
+    VertexCacheStats stats;
+    if (indexCount < 3 || vertexCount == 0)
+        return stats;
+
+    // a vertex is in the cache if it was transformed less than cacheSize misses ago
+    vector<size_t> transformedAt(vertexCount, 0);
+    vector<bool> used(vertexCount, false);
+    size_t misses = 0, uniqueVertices = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int index = indices[i];
+        if (!used[index])
+        {
+            used[index] = true;
+            uniqueVertices++;
+        }
+        else if (misses - transformedAt[index] < cacheSize)
+            continue;
+        transformedAt[index] = misses;
+        misses++;
+    }
+    stats.acmr = float(misses) / float(indexCount / 3);
+    stats.atvr = float(misses) / float(uniqueVertices);
+    return stats;
+}
+
+// merges vertices whose attributes are bitwise identical and rewrites the indices. Bone data is ignored, no mesh here is skinned.
+inline void weldVertices(vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+    // the attributes compared, in order: Position, Normal, TexCoords, Tangent, Bitangent
+    const size_t FLOATS = 14;
+    auto key = [](const Vertex& vertex, float out[FLOATS])
+    {
+        memcpy(out, &vertex.Position, sizeof(glm::vec3));
+        memcpy(out + 3, &vertex.Normal, sizeof(glm::vec3));
+        memcpy(out + 6, &vertex.TexCoords, sizeof(glm::vec2));
+        memcpy(out + 8, &vertex.Tangent, sizeof(glm::vec3));
+        memcpy(out + 11, &vertex.Bitangent, sizeof(glm::vec3));
+        for (size_t i = 0; i < FLOATS; i++)
+            out[i] += 0.0f; // -0 and +0 compare equal, make them hash equal too
+    };
+    auto hash = [](const float values[FLOATS])
+    {
+        uint64_t h = 14695981039346656037ull;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+        for (size_t i = 0; i < FLOATS * sizeof(float); i++)
+            h = (h ^ bytes[i]) * 1099511628211ull;
+        return h;
+    };
+
+    // open addressing table of indices into the welded vertex array, kept at most half full
+    size_t tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    const unsigned int EMPTY = ~0u;
+    vector<unsigned int> table(tableSize, EMPTY);
+    vector<unsigned int> remap(vertices.size());
+    vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    vector<float> weldedKeys;
+    weldedKeys.reserve(vertices.size() * FLOATS);
+
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        float values[FLOATS];
+        key(vertices[i], values);
+        size_t slot = hash(values) & (tableSize - 1);
+        while (table[slot] != EMPTY && memcmp(&weldedKeys[size_t(table[slot]) * FLOATS], values, sizeof(values)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+        if (table[slot] == EMPTY)
+        {
+            table[slot] = static_cast<unsigned int>(welded.size());
+            welded.push_back(vertices[i]);
+            weldedKeys.insert(weldedKeys.end(), values, values + FLOATS);
+        }
+        remap[i] = table[slot];
+    }
+
+    for (unsigned int& index : indices)
+        index = remap[index];
+    vertices.swap(welded);
+}
+
+// Forsyth's linear-speed vertex cache optimisation: greedily emits the triangle whose vertices score highest, where the score
+// favours vertices recently used (still in a simulated LRU cache) and vertices with few triangles left (to avoid leaving islands).
+inline void optimizeVertexCache(vector<unsigned int>& indices, size_t vertexCount)
+{
+    const int CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    auto vertexScore = [&](int cachePosition, unsigned int remainingTriangles)
+    {
+        if (remainingTriangles == 0)
+            return -1.0f; // no triangle needs this vertex anymore
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3) // the triangle just emitted, fixed score so it isn't favoured too much
+                score = LAST_TRIANGLE_SCORE;
+            else
+                score = powf(1.0f - float(cachePosition - 3) / float(CACHE_SIZE - 3), CACHE_DECAY_POWER);
+        }
+        return score + VALENCE_BOOST_SCALE * powf(float(remainingTriangles), -VALENCE_BOOST_POWER);
+    };
+
+    // vertex -> triangles adjacency, compacted as the triangles get emitted
+    vector<unsigned int> remaining(vertexCount, 0);
+    for (unsigned int index : indices)
+        remaining[index]++;
+    vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+    vector<unsigned int> adjacency(indices.size());
+    {
+        vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+    }
+
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+    vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+    vector<bool> emitted(triangleCount, false);
+
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+    vector<unsigned int> cache, nextCache;
+    cache.reserve(CACHE_SIZE + 3);
+    nextCache.reserve(CACHE_SIZE + 3);
+    size_t scanCursor = 0; // next triangle to look at when nothing in the cache has triangles left
+
+    // start with the best triangle overall
+    size_t best = 0;
+    for (size_t t = 1; t < triangleCount; t++)
+        if (triangleScore[t] > triangleScore[best])
+            best = t;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+    {
+        if (best == SIZE_MAX)
+        {
+            // dead end, take the next triangle in input order
+            while (emitted[scanCursor])
+                scanCursor++;
+            best = scanCursor;
+        }
+        emitted[best] = true;
+        const unsigned int* triangle = &indices[best * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+
+        // drop the triangle from its vertices' adjacency lists
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = triangle[k];
+            unsigned int* begin = &adjacency[adjacencyOffset[v]];
+            unsigned int* end = begin + remaining[v];
+            *std::find(begin, end, static_cast<unsigned int>(best)) = end[-1];
+            remaining[v]--;
+        }
+
+        // move the triangle's vertices to the front of the LRU cache
+        nextCache.assign(triangle, triangle + 3);
+        for (unsigned int v : cache)
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        cache.swap(nextCache);
+
+        // rescore every vertex that is or was in the cache, then the triangles around them, and pick the next best from those
+        best = SIZE_MAX;
+        float bestScore = -1.0f;
+        for (size_t position = 0; position < cache.size(); position++)
+        {
+            unsigned int v = cache[position];
+            int newPosition = position < size_t(CACHE_SIZE) ? int(position) : -1;
+            cachePosition[v] = newPosition;
+            float delta = vertexScore(newPosition, remaining[v]) - score[v];
+            score[v] += delta;
+            for (unsigned int a = adjacencyOffset[v]; a < adjacencyOffset[v] + remaining[v]; a++)
+            {
+                unsigned int t = adjacency[a];
+                triangleScore[t] += delta;
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (cache.size() > size_t(CACHE_SIZE))
+            cache.resize(CACHE_SIZE);
+    }
+    indices.swap(output);
+}
+
+// Sorts clusters of the cache optimized triangle order so that triangles facing away from the mesh centre are drawn first,
+// which makes the mesh draw roughly front to back from any view and lets early depth reject more fragments.
+// A cluster ends wherever the cache order restarted anyway (a triangle with all three vertices missing the cache),
+// so the cache efficiency only drops by at most 'threshold' (1.05 = 5% more vertex transforms).
+inline void optimizeOverdraw(vector<unsigned int>& indices, const vector<Vertex>& vertices, float threshold = 1.05f)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+    const unsigned int CACHE_SIZE = 16;
+
+    // split into clusters at hard cache boundaries
+    vector<size_t> clusterStarts;
+    {
+        vector<size_t> transformedAt(vertices.size(), SIZE_MAX);
+        size_t misses = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            int triangleMisses = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t * 3 + k];
+                if (transformedAt[v] == SIZE_MAX || misses - transformedAt[v] >= CACHE_SIZE)
+                {
+                    transformedAt[v] = misses++;
+                    triangleMisses++;
+                }
+            }
+            if (t == 0 || triangleMisses == 3)
+                clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+    if (clusterStarts.size() <= 2)
+        return;
+
+    // merge clusters that are too small to matter, sorting tiny ones only scatters the cache order
+    const size_t MIN_CLUSTER_TRIANGLES = 8;
+    vector<size_t> merged;
+    for (size_t i = 0; i + 1 < clusterStarts.size(); i++)
+        if (merged.empty() || clusterStarts[i] - merged.back() >= MIN_CLUSTER_TRIANGLES)
+            merged.push_back(clusterStarts[i]);
+    merged.push_back(triangleCount);
+    clusterStarts.swap(merged);
+
+    glm::vec3 meshCentre(0.0f);
+    for (const Vertex& vertex : vertices)
+        meshCentre += vertex.Position;
+    meshCentre /= float(vertices.size());
+
+    // sort key: how far the cluster lies out along its own average facing direction
+    struct Cluster { size_t start, end; float key; };
+    vector<Cluster> clusters;
+    for (size_t i = 0; i + 1 < clusterStarts.size(); i++)
+    {
+        Cluster cluster{ clusterStarts[i], clusterStarts[i + 1], 0.0f };
+        glm::vec3 centre(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = cluster.start; t < cluster.end; t++)
+        {
+            const glm::vec3& a = vertices[indices[t * 3]].Position;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& c = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 weightedNormal = glm::cross(b - a, c - a); // length is twice the area
+            float weight = glm::length(weightedNormal);
+            centre += (a + b + c) * (weight / 3.0f);
+            normal += weightedNormal;
+            area += weight;
+        }
+        if (area > 0.0f)
+        {
+            centre /= area;
+            float normalLength = glm::length(normal);
+            if (normalLength > 0.0f)
+                cluster.key = glm::dot(centre - meshCentre, normal / normalLength);
+        }
+        clusters.push_back(cluster);
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+
+    vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for (const Cluster& cluster : clusters)
+        sorted.insert(sorted.end(), indices.begin() + cluster.start * 3, indices.begin() + cluster.end * 3);
+
+    // keep the original order if the clusters cost more cache efficiency than allowed
+    VertexCacheStats before = analyzeVertexCache(indices.data(), indices.size(), vertices.size(), CACHE_SIZE);
+    VertexCacheStats after = analyzeVertexCache(sorted.data(), sorted.size(), vertices.size(), CACHE_SIZE);
+    if (after.acmr <= before.acmr * threshold)
+        indices.swap(sorted);
+}
+
+// renumbers the vertices in the order the index buffer first references them and drops unreferenced ones
+inline void optimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+    const unsigned int UNUSED = ~0u;
+    vector<unsigned int> remap(vertices.size(), UNUSED);
+    vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == UNUSED)
+        {
+            remap[index] = static_cast<unsigned int>(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(reordered);
+}
+
+// runs the whole pipeline on a freshly imported mesh, returns a line with the before/after cache statistics
+inline string optimizeMesh(MeshData& mesh, const string& name)
+{
+    if (mesh.indices.size() < 3)
+        return "  " + name + ": empty";
+    size_t importedVertices = mesh.vertices.size();
+    VertexCacheStats before = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+
+    weldVertices(mesh.vertices, mesh.indices);
+    optimizeVertexCache(mesh.indices, mesh.vertices.size());
+    optimizeOverdraw(mesh.indices, mesh.vertices);
+    optimizeVertexFetch(mesh.vertices, mesh.indices);
+
+    VertexCacheStats after = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+    char line[256];
+    snprintf(line, sizeof(line), "  %s: %zu -> %zu vertices, %zu triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %s indices",
+        name.c_str(), importedVertices, mesh.vertices.size(), mesh.indices.size() / 3, before.acmr, after.acmr, before.atvr, after.atvr,
+        mesh.vertices.size() <= 65536 ? "16-bit" : "32-bit");
+    return line;
+}
+#endif
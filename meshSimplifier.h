@@ -0,0 +1,390 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include "mesh.h"
+#include "meshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Quadric error metric simplification (Garland & Heckbert) by half-edge collapse: a vertex is always merged into one of its
+// neighbours, so the simplified index lists reference the original vertex buffer and LODs only cost extra indices.
+//
+// Vertices with the same position but different attributes ("wedges", e.g. both sides of a UV seam) are collapsed together,
+// each wedge onto the matching wedge of the target, and collapses that would tear a seam or an open border apart are rejected.
+// Border and seam edges also get extra planes in their quadrics so their outline is kept.
+
+// symmetric 4x4 error quadric, evaluates to the weighted mean squared distance to the planes that were added
+struct Quadric
+{
+    double a2 = 0, b2 = 0, c2 = 0, d2 = 0, ab = 0, ac = 0, ad = 0, bc = 0, bd = 0, cd = 0;
+    double weight = 0;
+
+    void addPlane(glm::vec3 n, float d, float w)
+    {
+        a2 += w * n.x * n.x; b2 += w * n.y * n.y; c2 += w * n.z * n.z; d2 += w * double(d) * d;
+        ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+        bc += w * n.y * n.z; bd += w * n.y * d; cd += w * n.z * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q)
+    {
+        a2 += q.a2; b2 += q.b2; c2 += q.c2; d2 += q.d2;
+        ab += q.ab; ac += q.ac; ad += q.ad;
+        bc += q.bc; bd += q.bd; cd += q.cd;
+        weight += q.weight;
+    }
+
+    // unnormalized error at p
+    double evaluate(glm::vec3 p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double error = a2 * x * x + b2 * y * y + c2 * z * z + 2.0 * (ab * x * y + ac * x * z + bc * y * z)
+            + 2.0 * (ad * x + bd * y + cd * z) + d2;
+        return error > 0.0 ? error : 0.0;
+    }
+};
+
+// simplifies an indexed triangle list towards targetIndexCount, never moving a vertex further than targetError
+// (an absolute object space distance, estimated by the quadrics). Returns the new index list into the same vertices
+// and the largest error of any collapse that was made in resultError.
+inline vector<unsigned int> simplifyMesh(const Vertex* vertices, size_t vertexCount, const unsigned int* indexData, size_t indexCount,
+    size_t targetIndexCount, float targetError, float* resultError = nullptr)
+{
+    const float BOUNDARY_WEIGHT = 10.0f; // how much more keeping a border/seam in place matters than the surface around it
+    const unsigned int NONE = ~0u;
+
+    vector<unsigned int> indices(indexData, indexData + indexCount);
+    if (resultError)
+        *resultError = 0.0f;
+    if (indexCount <= targetIndexCount || vertexCount == 0)
+        return indices;
+
+    // group vertices by position: remap points at the group's first vertex, wedge links each group into a ring
+    vector<unsigned int> remap(vertexCount), wedge(vertexCount);
+    {
+        unordered_map<uint64_t, vector<unsigned int>> buckets;
+        buckets.reserve(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            glm::vec3 position = vertices[v].Position + glm::vec3(0.0f); // -0 == +0
+            uint32_t bits[3];
+            memcpy(bits, &position, sizeof(bits));
+            uint64_t key = (uint64_t(bits[0]) * 73856093u) ^ (uint64_t(bits[1]) * 19349663u << 20) ^ (uint64_t(bits[2]) * 83492791u << 40);
+            vector<unsigned int>& bucket = buckets[key];
+            unsigned int canonical = NONE;
+            for (unsigned int other : bucket)
+                if (vertices[other].Position == position)
+                    canonical = other;
+            if (canonical == NONE)
+            {
+                bucket.push_back(static_cast<unsigned int>(v));
+                remap[v] = static_cast<unsigned int>(v);
+                wedge[v] = static_cast<unsigned int>(v);
+            }
+            else
+            {
+                remap[v] = canonical;
+                wedge[v] = wedge[canonical];
+                wedge[canonical] = static_cast<unsigned int>(v);
+            }
+        }
+    }
+    // positions shared by more than two wedges are corners of several seams, keep them
+    vector<bool> locked(vertexCount, false);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        if (remap[v] != v)
+            continue;
+        int wedges = 1;
+        for (unsigned int w = wedge[v]; w != v; w = wedge[w])
+            wedges++;
+        locked[v] = wedges > 2;
+    }
+
+    auto positionOf = [&](unsigned int v) { return vertices[v].Position; };
+    auto edgeKey = [](unsigned int a, unsigned int b) { return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a; };
+
+    // per position edge: how many triangles use it and whether they disagree on the wedges (a seam)
+    struct Edge
+    {
+        unsigned int count = 0;
+        unsigned int wedgeA = 0, wedgeB = 0; // wedges of the lower and higher position of the first triangle seen
+        bool seam = false;
+        bool boundary() const { return count == 1 || seam; }
+    };
+    auto classifyEdges = [&](unordered_map<uint64_t, Edge>& edges)
+    {
+        edges.clear();
+        edges.reserve(indices.size());
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+                if (remap[a] > remap[b])
+                    std::swap(a, b);
+                Edge& edge = edges[edgeKey(remap[a], remap[b])];
+                if (edge.count++ == 0)
+                {
+                    edge.wedgeA = a;
+                    edge.wedgeB = b;
+                }
+                else if (edge.wedgeA != a || edge.wedgeB != b)
+                    edge.seam = true;
+            }
+        }
+    };
+
+    // initial quadrics: area weighted triangle planes, plus perpendicular planes along borders and seams
+    vector<Quadric> quadrics(vertexCount);
+    unordered_map<uint64_t, Edge> edges;
+    classifyEdges(edges);
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+        glm::vec3 p0 = positionOf(indices[t]), p1 = positionOf(indices[t + 1]), p2 = positionOf(indices[t + 2]);
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length == 0.0f)
+            continue;
+        normal /= length;
+        for (int k = 0; k < 3; k++)
+            quadrics[remap[indices[t + k]]].addPlane(normal, -glm::dot(normal, p0), length * 0.5f);
+
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int a = remap[indices[t + k]], b = remap[indices[t + (k + 1) % 3]];
+            if (!edges[edgeKey(a, b)].boundary())
+                continue;
+            glm::vec3 direction = positionOf(b) - positionOf(a);
+            glm::vec3 planeNormal = glm::cross(direction, normal);
+            float planeLength = glm::length(planeNormal);
+            if (planeLength == 0.0f)
+                continue;
+            planeNormal /= planeLength;
+            float weight = glm::dot(direction, direction) * BOUNDARY_WEIGHT;
+            quadrics[a].addPlane(planeNormal, -glm::dot(planeNormal, positionOf(a)), weight);
+            quadrics[b].addPlane(planeNormal, -glm::dot(planeNormal, positionOf(a)), weight);
+        }
+    }
+    auto collapseError = [&](unsigned int from, unsigned int to)
+    {
+        Quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        return q.weight > 0.0 ? q.evaluate(positionOf(to)) / q.weight : 0.0;
+    };
+
+    double maxError = 0.0;
+    double errorLimit = double(targetError) * targetError;
+    size_t triangleCount = indices.size() / 3;
+    vector<unsigned int> adjacencyOffset(vertexCount + 1), adjacency;
+    vector<bool> boundaryVertex(vertexCount);
+    vector<bool> touched(vertexCount);
+    vector<pair<unsigned int, unsigned int>> wedgeTargets; // wedge of the collapsed position -> wedge it becomes
+
+    auto degenerate = [&](size_t t)
+    {
+        unsigned int a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+        return a == b || b == c || a == c;
+    };
+
+    // collapses position 'from' onto position 'to' if that keeps wedges, borders and triangle orientation intact
+    auto tryCollapse = [&](unsigned int from, unsigned int to)
+    {
+        // every wedge of 'from' that is still in use has to meet exactly one wedge of 'to' in its triangles
+        wedgeTargets.clear();
+        unsigned int w = from;
+        do
+        {
+            bool used = false;
+            unsigned int target = NONE;
+            for (unsigned int a = adjacencyOffset[from]; a < adjacencyOffset[from + 1]; a++)
+            {
+                size_t t = size_t(adjacency[a]) * 3;
+                if (degenerate(t) || (indices[t] != w && indices[t + 1] != w && indices[t + 2] != w))
+                    continue;
+                used = true;
+                for (int k = 0; k < 3; k++)
+                {
+                    if (remap[indices[t + k]] != to)
+                        continue;
+                    if (target != NONE && target != indices[t + k])
+                        return false;
+                    target = indices[t + k];
+                }
+            }
+            if (used)
+            {
+                if (target == NONE)
+                    return false;
+                wedgeTargets.emplace_back(w, target);
+            }
+            w = wedge[w];
+        } while (w != from);
+
+        // no triangle may flip over or collapse to a sliver
+        for (unsigned int a = adjacencyOffset[from]; a < adjacencyOffset[from + 1]; a++)
+        {
+            size_t t = size_t(adjacency[a]) * 3;
+            if (degenerate(t))
+                continue;
+            glm::vec3 corners[3], moved[3];
+            bool containsTo = false;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int position = remap[indices[t + k]];
+                containsTo |= position == to;
+                corners[k] = positionOf(indices[t + k]);
+                moved[k] = position == from ? positionOf(to) : corners[k];
+            }
+            if (containsTo)
+                continue; // this triangle disappears
+            glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+            glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+            if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+                return false;
+        }
+
+        // rewrite the triangles around 'from'
+        for (unsigned int a = adjacencyOffset[from]; a < adjacencyOffset[from + 1]; a++)
+        {
+            size_t t = size_t(adjacency[a]) * 3;
+            if (degenerate(t))
+                continue;
+            for (int k = 0; k < 3; k++)
+                for (const auto& mapping : wedgeTargets)
+                    if (indices[t + k] == mapping.first)
+                    {
+                        indices[t + k] = mapping.second;
+                        break;
+                    }
+            if (degenerate(t))
+                triangleCount--;
+        }
+        return true;
+    };
+
+    // passes of independent collapses in order of increasing error, until the target is reached or nothing can be collapsed
+    while (triangleCount * 3 > targetIndexCount)
+    {
+        // triangles around each position
+        std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0u);
+        for (unsigned int index : indices)
+            adjacencyOffset[remap[index] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyOffset[v + 1] += adjacencyOffset[v];
+        adjacency.resize(indices.size());
+        {
+            vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++)
+                adjacency[fill[remap[indices[i]]]++] = static_cast<unsigned int>(i / 3);
+        }
+
+        classifyEdges(edges);
+        std::fill(boundaryVertex.begin(), boundaryVertex.end(), false);
+        for (const auto& edge : edges)
+            if (edge.second.boundary())
+                boundaryVertex[edge.first >> 32] = boundaryVertex[edge.first & 0xFFFFFFFFu] = true;
+
+        // cheapest direction of every edge. Border and seam vertices may only slide along their border or seam.
+        struct Collapse { unsigned int from, to; double error; };
+        vector<Collapse> collapses;
+        collapses.reserve(edges.size());
+        for (const auto& edge : edges)
+        {
+            unsigned int a = unsigned(edge.first >> 32), b = unsigned(edge.first & 0xFFFFFFFFu);
+            Collapse best{ NONE, NONE, 0.0 };
+            for (int direction = 0; direction < 2; direction++)
+            {
+                unsigned int from = direction ? b : a, to = direction ? a : b;
+                if (locked[from] || (boundaryVertex[from] && !edge.second.boundary()))
+                    continue;
+                double error = collapseError(from, to);
+                if (best.from == NONE || error < best.error)
+                    best = { from, to, error };
+            }
+            if (best.from != NONE && best.error <= errorLimit)
+                collapses.push_back(best);
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+        std::fill(touched.begin(), touched.end(), false);
+        size_t collapsed = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (triangleCount * 3 <= targetIndexCount)
+                break;
+            if (touched[collapse.from] || touched[collapse.to] || !tryCollapse(collapse.from, collapse.to))
+                continue;
+            touched[collapse.from] = touched[collapse.to] = true;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            maxError = std::max(maxError, collapse.error);
+            collapsed++;
+        }
+
+        // drop the triangles that collapsed to lines
+        size_t write = 0;
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            if (degenerate(t))
+                continue;
+            indices[write] = indices[t];
+            indices[write + 1] = indices[t + 1];
+            indices[write + 2] = indices[t + 2];
+            write += 3;
+        }
+        indices.resize(write);
+        triangleCount = write / 3;
+        if (collapsed == 0)
+            break;
+    }
+
+    if (resultError)
+        *resultError = float(sqrt(maxError));
+    return indices;
+}
+
+// builds up to maxLods simplified versions of a mesh, each aiming at half the triangles of the previous one.
+// Stops early when a level can't get meaningfully smaller within maxError (relative to the mesh size).
+inline void generateLods(MeshData& mesh, int maxLods = 4, float maxError = 0.05f)
+{
+    const Vertex* vertices = mesh.vertexData();
+    size_t vertexCount = mesh.vertexCount();
+    if (vertexCount == 0 || mesh.indexCount() < 3 * 64)
+        return;
+
+    glm::vec3 minimum = vertices[0].Position, maximum = vertices[0].Position;
+    for (size_t i = 1; i < vertexCount; i++)
+    {
+        minimum = glm::min(minimum, vertices[i].Position);
+        maximum = glm::max(maximum, vertices[i].Position);
+    }
+    glm::vec3 size = maximum - minimum;
+    float extent = std::max(size.x, std::max(size.y, size.z));
+
+    size_t previousCount = mesh.indexCount();
+    for (int level = 1; level <= maxLods; level++)
+    {
+        size_t target = (previousCount / 2) / 3 * 3;
+        float error = 0.0f;
+        // simplify from the full mesh every time, so errors don't stack up from level to level
+        vector<unsigned int> lod = simplifyMesh(vertices, vertexCount, mesh.indexData(), mesh.indexCount(), target, maxError * extent, &error);
+        if (lod.size() < 3 || lod.size() > previousCount * 4 / 5)
+            break;
+        optimizeVertexCache(lod, vertexCount);
+
+        MeshLod entry;
+        entry.firstIndex = static_cast<unsigned int>(mesh.lodIndices.size());
+        entry.indexCount = static_cast<unsigned int>(lod.size());
+        entry.error = error;
+        mesh.lods.push_back(entry);
+        mesh.lodIndices.insert(mesh.lodIndices.end(), lod.begin(), lod.end());
+        previousCount = lod.size();
+    }
+}
+#endif
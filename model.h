@@ -13,85 +13,624 @@
 #include <assimp/postprocess.h>
 #include "filesystem.h"
 #include "mesh.h"
+#include "renderQueue.h"
+#include "sceneGraph.h"
+#include "meshCache.h"
+#include "meshOptimizer.h"
+#include "meshSimplifier.h"
+#include "objParser.h"
 #include "shader_s.h"
+#include "textureCache.h"
+#include "threadPool.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <vector>
+#include <chrono>
 using namespace std;
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
 
+// post-processing steps requested from Assimp. Part of the mesh cache key, so changing them invalidates cached meshes.
+const unsigned int MODEL_POST_PROCESS_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+// everything needed to build a Model that doesn't touch OpenGL: mesh arrays and decoded material textures.
+// It can be produced on any thread and is turned into GL objects by the Model constructor on the GL thread.
+struct ModelData
+{
+    string path;
+    string directory;
+    vector<MeshData> meshes;
+    vector<ModelNode> nodes;        // the imported hierarchy, parents first; a single root for files without one
+    vector<unsigned int> nodeMeshes; // the mesh references of the nodes, indices into meshes
+    map<string, ImageData> images;  // material textures by path relative to directory, decoded once unless already resident
+    unique_ptr<MeshCache> cache;    // keeps a memory-mapped cache entry alive until the meshes are uploaded
+    bool gamma = false;
+    VertexFormat vertexFormat = VERTEX_FORMAT_FULL;
+    glm::vec3 positionOffset = glm::vec3(0.0f); // packed position decode, set by packMeshes
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    Bounds bounds;                              // of all meshes, in model space
+    bool valid = false;
+};
+
+// a copy of a Model placed in a SceneGraph by Model::instantiate: the graph node of each model node and, for each mesh
+// that several nodes reference, an instance buffer with the world transforms of those nodes, kept by
+// Model::updateInstance. GL thread only, release() before the model is deleted.
+struct ModelInstance
+{
+    vector<int> nodes;
+    vector<unique_ptr<InstanceBuffer>> sharedInstances; // one per Model::sharedMeshCount()
+    glm::vec3 color = glm::vec3(-1.0f);                 // instance color the buffers hold
+
+    void release()
+    {
+        for (unique_ptr<InstanceBuffer>& instances : sharedInstances)
+            instances->release();
+        sharedInstances.clear();
+    }
+};
+
 class Model
 {
 public:
     // model data 
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    vector<Texture> textures_loaded;	// textures referenced by this model, one per path. Owned by the TextureCache, released when the model is deleted.
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    VertexFormat vertexFormat;
+    GeometryArena arena;            // vertices and indices of all meshes, one VAO
+    glm::vec3 positionOffset = glm::vec3(0.0f); // dequantization of packed positions, identity for full vertices
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    Bounds bounds;                              // box and sphere in model space, for culling and LOD selection
+    vector<ModelNode> nodes;                    // hierarchy the meshes hang off, parents first
+    vector<glm::mat4> nodeTransforms;           // rest pose of each node in model space
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const& path, bool gamma = false) : gammaCorrection(gamma), vertexFormat(VERTEX_FORMAT_FULL), arena(vertexLayout(VERTEX_FORMAT_FULL))
+    {
+        ModelData data = loadData(path, gamma);
+        upload(data);
+    }
+
+    // constructor, uploads model data loaded ahead of time (e.g. by a ModelLoader worker). Must run on the GL thread.
+    Model(ModelData& data) : gammaCorrection(data.gamma), vertexFormat(data.vertexFormat), arena(vertexLayout(data.vertexFormat))
+    {
+        upload(data);
+    }
+
+    // constructor, an empty model that draws nothing, in place of one that failed to load
+    Model() : gammaCorrection(false), vertexFormat(VERTEX_FORMAT_FULL), arena(vertexLayout(VERTEX_FORMAT_FULL))
+    {
+    }
+
+    // gives the texture references back to the TextureCache and frees the mesh buffers. Must run on the GL thread.
+    ~Model()
+    {
+        for (const Texture& texture : textures_loaded)
+            TextureCache::get().release(texture.id);
+        arena.release();
+    }
+
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    // size of the vertex buffer of all meshes, to compare vertex formats
+    size_t vertexBytes() const
+    {
+        return arena.vertexBufferBytes();
+    }
+
+    // number of detail levels, 0 is the full model. 0 levels for a model that failed to load.
+    int lodCount() const
+    {
+        return static_cast<int>(lods.size());
+    }
+
+    int lodTriangles(int lod) const
+    {
+        if (lods.empty())
+            return 0;
+        return lods[std::min<size_t>(lod, lods.size() - 1)].triangles;
+    }
+
+    // picks the coarsest LOD whose simplification error projects to at most pixelError pixels, using the model's
+    // bounding sphere to find the distance of its nearest point and the scale of the transform
+    int selectLod(const glm::mat4& modelView, const glm::mat4& projection, float viewportHeight, float pixelError = 1.0f) const
+    {
+        if (lods.size() < 2)
+            return 0;
+        float scale = std::max(glm::length(glm::vec3(modelView[0])), std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+        glm::vec3 center = glm::vec3(modelView * glm::vec4(bounds.center, 1.0f));
+        float distance = -center.z - bounds.radius * scale;
+        if (distance <= 0.0f)
+            return 0; // the camera is inside or very close to the sphere
+        float pixelsPerUnit = projection[1][1] * 0.5f * viewportHeight / distance;
+        for (int lod = static_cast<int>(lods.size()) - 1; lod > 0; lod--)
+            if (lods[lod].error * scale * pixelsPerUnit <= pixelError)
+                return lod;
+        return 0;
+    }
+
+    // on-screen radius of the bounding sphere in pixels, for the LOD debug overlay
+    float projectedRadius(const glm::mat4& modelView, const glm::mat4& projection, float viewportHeight) const
+    {
+        float scale = std::max(glm::length(glm::vec3(modelView[0])), std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+        glm::vec3 center = glm::vec3(modelView * glm::vec4(bounds.center, 1.0f));
+        return -center.z > 0.0f ? bounds.radius * scale * projection[1][1] * 0.5f * viewportHeight / -center.z : 0.0f;
+    }
+
+    // draws the model, and thus all its meshes: one VAO bind and one multi-draw per run of meshes sharing their textures.
+    // The caller's model uniform is used for every mesh, node transforms only apply to Submit and the instanced paths,
+    // so a mesh several nodes reference is drawn once.
+    void Draw(Shader& shader, int lod = 0)
+    {
+        if (lods.empty())
+            return; // the model failed to load and has nothing to draw
+        // tell the vertex shader how to decode the vertices
+        shader.setVec3("positionOffset", positionOffset);
+        shader.setVec3("positionScale", positionScale);
+        shader.setBool("octahedralNormals", vertexFormat == VERTEX_FORMAT_PACKED);
+
+        arena.bind();
+        for (const DrawGroup& group : lods[std::min<size_t>(lod, lods.size() - 1)].drawGroups)
+        {
+            meshes[group.firstMesh].bindTextures(shader);
+            arena.draw(group.draws);
+        }
+        for (const SharedMesh& shared : sharedMeshes)
+        {
+            meshes[shared.mesh].bindTextures(shader);
+            arena.draw(meshes[shared.mesh].lodRange(lod));
+        }
+    }
+
+    // draws every instance in instances with one instanced call per mesh, for shaders built with INSTANCED: the
+    // transform and color come from the instance buffer instead of uniforms
+    void DrawInstanced(Shader& shader, InstanceBuffer& instances, int lod = 0)
+    {
+        if (lods.empty())
+            return;
+        shader.setVec3("positionOffset", positionOffset);
+        shader.setVec3("positionScale", positionScale);
+        shader.setBool("octahedralNormals", vertexFormat == VERTEX_FORMAT_PACKED);
+
+        GlState::get().bindVertexArray(instances.vertexArray(arena));
+        for (const DrawGroup& group : lods[std::min<size_t>(lod, lods.size() - 1)].drawGroups)
+        {
+            // the node's rest transform goes before the instance's
+            shader.setMat4("model", nodeTransforms[group.node]);
+            shader.setMat3("normalMatrix", normalMatrix(nodeTransforms[group.node]));
+            meshes[group.firstMesh].bindTextures(shader);
+            arena.drawInstanced(group.draws, static_cast<GLsizei>(instances.size()));
+        }
+        for (const SharedMesh& shared : sharedMeshes)
+        {
+            meshes[shared.mesh].bindTextures(shader);
+            for (int node : shared.nodes)
+            {
+                shader.setMat4("model", nodeTransforms[node]);
+                shader.setMat3("normalMatrix", normalMatrix(nodeTransforms[node]));
+                arena.drawInstanced(meshes[shared.mesh].lodRange(lod), static_cast<GLsizei>(instances.size()));
+            }
+        }
+    }
+
+    // queues the model for drawing: one item per run of meshes sharing their textures and node, like Draw, placed by
+    // transform and the rest pose of the nodes. depth is the view distance of the model, for the queue's ordering.
+    void Submit(RenderQueue& queue, RenderPass pass, Shader& shader, const glm::mat4& transform, int lod = 0, float depth = 0.0f) const
+    {
+        if (lods.empty())
+            return;
+        DrawItem item = drawItem(shader);
+        item.hasTransform = true;
+        int itemNode = -1;
+        for (const DrawGroup& group : lods[std::min<size_t>(lod, lods.size() - 1)].drawGroups)
+        {
+            if (group.node != itemNode)
+            {
+                itemNode = group.node;
+                item.transform = hasNodeTransforms ? transform * nodeTransforms[group.node] : transform;
+                item.normalMatrix = normalMatrix(item.transform); // once per object, not per vertex
+            }
+            item.batch = &group.draws;
+            item.material = &meshes[group.firstMesh];
+            queue.submit(pass, item, depth);
+        }
+        submitReferences(queue, pass, item, lod, depth, [&](int node) { return transform * nodeTransforms[node]; });
+    }
+
+    // the same for a copy placed in a scene graph by instantiate(), each node drawn with its world matrix. Meshes that
+    // several nodes reference are drawn with one instanced draw from the copy's buffers when an instancedShader (built
+    // with INSTANCED) is given and updateInstance() ran since the graph's update, otherwise once per reference.
+    void Submit(RenderQueue& queue, RenderPass pass, Shader& shader, const SceneGraph& graph, const ModelInstance& instance, Shader* instancedShader = nullptr, int lod = 0, float depth = 0.0f) const
+    {
+        if (lods.empty())
+            return;
+        DrawItem item = drawItem(shader);
+        item.hasTransform = true;
+        int itemNode = -1;
+        for (const DrawGroup& group : lods[std::min<size_t>(lod, lods.size() - 1)].drawGroups)
+        {
+            if (group.node != itemNode)
+            {
+                itemNode = group.node;
+                item.transform = graph.world(instance.nodes[group.node]);
+                item.normalMatrix = normalMatrix(item.transform);
+            }
+            item.batch = &group.draws;
+            item.material = &meshes[group.firstMesh];
+            queue.submit(pass, item, depth);
+        }
+        if (!instancedShader || instance.sharedInstances.size() != sharedMeshes.size())
+        {
+            submitReferences(queue, pass, item, lod, depth, [&](int node) { return graph.world(instance.nodes[node]); });
+            return;
+        }
+        // the instance transforms are in world space already
+        DrawItem instanced = drawItem(*instancedShader);
+        instanced.hasTransform = true;
+        for (size_t i = 0; i < sharedMeshes.size(); i++)
+        {
+            instanced.instances = instance.sharedInstances[i].get();
+            instanced.range = meshes[sharedMeshes[i].mesh].lodRange(lod);
+            instanced.material = &meshes[sharedMeshes[i].mesh];
+            queue.submit(pass, instanced, depth);
+        }
+    }
+
+    // adds the node hierarchy to graph under parent, for Submit
+    ModelInstance instantiate(SceneGraph& graph, int parent) const
+    {
+        ModelInstance instance;
+        instance.nodes.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            const ModelNode& node = nodes[i];
+            instance.nodes[i] = graph.add(node.parent < 0 ? parent : instance.nodes[node.parent], node.position, node.rotation, node.scale);
+        }
+        return instance;
+    }
+
+    // rewrites the instance buffer of each shared mesh with a node that moved in the last graph update, all of them
+    // the first time or when color changes. Call after every SceneGraph::update the copy is drawn after.
+    void updateInstance(ModelInstance& instance, const SceneGraph& graph, const glm::vec3& color) const
     {
-        loadModel(path);
+        bool rewriteAll = color != instance.color;
+        instance.color = color;
+        if (instance.sharedInstances.size() != sharedMeshes.size())
+        {
+            instance.release();
+            for (size_t i = 0; i < sharedMeshes.size(); i++)
+            {
+                instance.sharedInstances.push_back(make_unique<InstanceBuffer>());
+                instance.sharedInstances.back()->create();
+            }
+            rewriteAll = true;
+        }
+        vector<InstanceData> references;
+        for (size_t i = 0; i < sharedMeshes.size(); i++)
+        {
+            bool moved = rewriteAll;
+            for (size_t j = 0; j < sharedMeshes[i].nodes.size() && !moved; j++)
+                moved = graph.changed(instance.nodes[sharedMeshes[i].nodes[j]]);
+            if (!moved)
+                continue;
+            references.resize(sharedMeshes[i].nodes.size());
+            for (size_t j = 0; j < references.size(); j++)
+            {
+                references[j].transform = graph.world(instance.nodes[sharedMeshes[i].nodes[j]]);
+                references[j].normalMatrix = normalMatrix(references[j].transform);
+                references[j].color = color;
+            }
+            instance.sharedInstances[i]->update(references);
+        }
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader& shader)
+    // number of meshes that several nodes reference
+    size_t sharedMeshCount() const
     {
-        for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        return sharedMeshes.size();
+    }
+
+    // queues DrawInstanced
+    void SubmitInstanced(RenderQueue& queue, RenderPass pass, Shader& shader, InstanceBuffer& instances, int lod = 0, float depth = 0.0f) const
+    {
+        if (lods.empty())
+            return;
+        DrawItem item = drawItem(shader);
+        item.instances = &instances;
+        item.hasTransform = true;
+        for (const DrawGroup& group : lods[std::min<size_t>(lod, lods.size() - 1)].drawGroups)
+        {
+            item.transform = nodeTransforms[group.node];
+            item.normalMatrix = normalMatrix(item.transform);
+            item.batch = &group.draws;
+            item.material = &meshes[group.firstMesh];
+            queue.submit(pass, item, depth);
+        }
+        submitReferences(queue, pass, item, lod, depth, [&](int node) { return nodeTransforms[node]; });
+    }
+
+    // loads a model from the mesh cache if it has a valid entry for this file, otherwise imports it with ASSIMP and writes one.
+    // Material textures are decoded as well, in parallel when a pool is given, and the vertices are packed if the format asks for it.
+    // Makes no GL calls, so it is safe to run on a worker thread.
+    static ModelData loadData(string const& path, bool gamma = false, ThreadPool* pool = nullptr, VertexFormat vertexFormat = VERTEX_FORMAT_FULL)
+    {
+        auto start = chrono::steady_clock::now();
+        ModelData data;
+        data.path = path;
+        data.gamma = gamma;
+        data.vertexFormat = vertexFormat;
+        // retrieve the directory path of the filepath
+        data.directory = path.substr(0, path.find_last_of('/'));
+
+        data.cache = make_unique<MeshCache>();
+        if (data.cache->open(path, MODEL_POST_PROCESS_FLAGS))
+        {
+            for (unsigned int i = 0; i < data.cache->meshCount(); i++)
+                data.meshes.push_back(data.cache->mesh(i));
+            for (unsigned int i = 0; i < data.cache->nodeCount(); i++)
+                data.nodes.push_back(data.cache->node(i));
+            for (unsigned int i = 0; i < data.cache->nodeMeshCount(); i++)
+                data.nodeMeshes.push_back(data.cache->nodeMesh(i));
+            addRootNode(data);
+            computeBounds(data);
+            loadImages(data, pool);
+            packMeshes(data, pool);
+            float cachedMs = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+            cout << "Loaded " << path << " from mesh cache in " << cachedMs << " ms (import took " << data.cache->importMs() << " ms)" << endl;
+            data.valid = true;
+            return data;
+        }
+
+        // .obj files go through the native parser, Assimp handles everything else and whatever the parser rejects
+        const char* importer = "the OBJ parser";
+        bool isObj = path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0;
+        if (!isObj || !parseObj(path, data.meshes, pool))
+        {
+            if (isObj)
+                cout << "Falling back to Assimp for " << path << endl;
+            data.meshes.clear();
+            data.nodes.clear();
+            data.nodeMeshes.clear();
+            importer = "Assimp";
+            if (!importAssimp(path, data))
+                return data;
+        }
+        addRootNode(data);
+        optimizeMeshes(data, pool);
+        buildLods(data, pool);
+        computeBounds(data);
+        loadImages(data, pool);
+        packMeshes(data, pool);
+
+        float importMs = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Loaded " << path << " with " << importer << " in " << importMs << " ms" << endl;
+        if (!data.cache->write(data.meshes, data.nodes, data.nodeMeshes, importMs))
+            cout << "ERROR::MESH_CACHE:: failed to write cache entry for " << path << endl;
+        data.valid = true;
+        return data;
     }
 
 private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const& path)
+    // meshes that are drawn with one glMultiDrawElementsBaseVertex, they all use the textures of meshes[firstMesh] and
+    // hang off the same node
+    struct DrawGroup
+    {
+        size_t firstMesh;
+        int node;
+        DrawBatch draws;
+    };
+    // per detail level: the draw calls and the numbers the LOD selection and overlay need
+    struct Lod
+    {
+        vector<DrawGroup> drawGroups;
+        float error = 0.0f; // largest error of any mesh at this level
+        int triangles = 0;
+    };
+    vector<Lod> lods;
+    bool hasNodeTransforms = false; // some node's rest pose isn't the identity
+
+    // a mesh that several nodes reference, uploaded once and drawn once per node or instanced over the nodes. Meshes
+    // referenced by one node are in the draw groups instead.
+    struct SharedMesh
+    {
+        size_t mesh;
+        vector<int> nodes;
+    };
+    vector<SharedMesh> sharedMeshes;
+
+    // queues each reference of the shared meshes as its own draw, item's shader and instances are kept and its transform
+    // is placement(node)
+    template<typename Placement>
+    void submitReferences(RenderQueue& queue, RenderPass pass, DrawItem item, int lod, float depth, Placement placement) const
+    {
+        item.batch = nullptr;
+        for (const SharedMesh& shared : sharedMeshes)
+        {
+            item.range = meshes[shared.mesh].lodRange(lod);
+            item.material = &meshes[shared.mesh];
+            for (int node : shared.nodes)
+            {
+                item.transform = placement(node);
+                item.normalMatrix = normalMatrix(item.transform);
+                queue.submit(pass, item, depth);
+            }
+        }
+    }
+
+    // what every item of the model shares
+    DrawItem drawItem(Shader& shader) const
+    {
+        DrawItem item;
+        item.shader = &shader;
+        item.arena = &arena;
+        item.positionOffset = positionOffset;
+        item.positionScale = positionScale;
+        item.octahedralNormals = vertexFormat == VERTEX_FORMAT_PACKED;
+        return item;
+    }
+
+    // model space transform of every node from the local ones, parents come first
+    static vector<glm::mat4> restPose(const vector<ModelNode>& nodes)
+    {
+        vector<glm::mat4> transforms(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            glm::mat4 local = SceneGraph::localMatrix(nodes[i].position, nodes[i].rotation, nodes[i].scale);
+            transforms[i] = nodes[i].parent < 0 ? local : transforms[nodes[i].parent] * local;
+        }
+        return transforms;
+    }
+
+    // creates the GL textures and buffers for data loaded by loadData.
+    void upload(ModelData& data)
+    {
+        if (!data.valid)
+            return;
+        auto start = chrono::steady_clock::now();
+        directory = data.directory;
+        positionOffset = data.positionOffset;
+        positionScale = data.positionScale;
+        bounds = data.bounds;
+        nodes = data.nodes;
+        nodeTransforms = restPose(nodes);
+        for (const glm::mat4& transform : nodeTransforms)
+            hasNodeTransforms = hasNodeTransforms || transform != glm::mat4(1.0f);
+
+        meshes.reserve(data.meshes.size());
+        unordered_map<string, unsigned int> textureIds; // path -> id of the textures acquired for this model so far
+        for (const MeshData& mesh : data.meshes)
+        {
+            vector<Texture> textures;
+            for (const Texture& texture : mesh.textures)
+                textures.push_back(loadTexture(texture, data, textureIds));
+            meshes.push_back(Mesh(mesh, textures, arena, vertexFormat));
+        }
+        arena.upload();
+
+        // meshes referenced by more than one node are drawn per reference or instanced, see SharedMesh
+        vector<int> sharedIndex(meshes.size(), -1);
+        vector<unsigned int> references(meshes.size(), 0);
+        for (unsigned int mesh : data.nodeMeshes)
+            references[mesh]++;
+        for (size_t node = 0; node < nodes.size(); node++)
+        {
+            for (unsigned int r = nodes[node].firstMesh; r < nodes[node].firstMesh + nodes[node].meshCount; r++)
+            {
+                unsigned int mesh = data.nodeMeshes[r];
+                if (references[mesh] < 2)
+                    continue;
+                if (sharedIndex[mesh] < 0)
+                {
+                    sharedIndex[mesh] = static_cast<int>(sharedMeshes.size());
+                    sharedMeshes.push_back({ mesh, vector<int>() });
+                }
+                sharedMeshes[sharedIndex[mesh]].nodes.push_back(static_cast<int>(node));
+            }
+        }
+
+        // consecutive meshes of a node with the same textures share a draw call, at every LOD
+        size_t lodCount = 1;
+        for (const Mesh& mesh : meshes)
+            lodCount = std::max(lodCount, mesh.lodRanges.size());
+        lods.resize(lodCount);
+        for (size_t lod = 0; lod < lodCount; lod++)
+        {
+            vector<DrawGroup>& drawGroups = lods[lod].drawGroups;
+            for (size_t node = 0; node < nodes.size(); node++)
+            {
+                bool newGroup = true;
+                for (unsigned int r = nodes[node].firstMesh; r < nodes[node].firstMesh + nodes[node].meshCount; r++)
+                {
+                    size_t i = data.nodeMeshes[r];
+                    const ArenaRange& range = meshes[i].lodRange(lod);
+                    lods[lod].triangles += range.indexCount / 3;
+                    lods[lod].error = std::max(lods[lod].error, meshes[i].lodErrors[std::min(lod, meshes[i].lodErrors.size() - 1)]);
+                    if (references[i] > 1)
+                        continue;
+                    if (newGroup || !meshes[i].sameTextures(meshes[drawGroups.back().firstMesh]))
+                        drawGroups.push_back({ i, static_cast<int>(node), DrawBatch() });
+                    newGroup = false;
+                    arena.addToBatch(drawGroups.back().draws, range);
+                }
+            }
+        }
+
+        float uploadMs = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Uploaded " << data.path << " in " << uploadMs << " ms (" << meshes.size() << " meshes, " << data.nodeMeshes.size() << " references, "
+            << lods[0].drawGroups.size() + sharedMeshes.size() << " draw calls, " << lods.size() << " LODs)" << endl;
+    }
+
+    // reads the file via ASSIMP into data.meshes
+    static bool importAssimp(string const& path, ModelData& data)
     {
-        // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, MODEL_POST_PROCESS_FLAGS);
         // check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            return false;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
-
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        // process ASSIMP's root node recursively, converting each mesh at its first reference
+        vector<int> converted(scene->mNumMeshes, -1);
+        processNode(scene->mRootNode, scene, data, -1, converted);
+        return true;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode* node, const aiScene* scene)
+    // The node itself is kept with its transform relative to parent, children are added after their parent. Meshes are
+    // converted once, converted maps the scene's mesh indices to data.meshes for the nodes that reference them again.
+    static void processNode(aiNode* node, const aiScene* scene, ModelData& data, int parent, vector<int>& converted)
     {
+        ModelNode modelNode;
+        modelNode.parent = parent;
+        aiVector3D scaling, position;
+        aiQuaternion rotation;
+        node->mTransformation.Decompose(scaling, rotation, position);
+        modelNode.position = glm::vec3(position.x, position.y, position.z);
+        modelNode.rotation = glm::quat(rotation.w, rotation.x, rotation.y, rotation.z);
+        modelNode.scale = glm::vec3(scaling.x, scaling.y, scaling.z);
+        modelNode.firstMesh = static_cast<unsigned int>(data.nodeMeshes.size());
+        modelNode.meshCount = node->mNumMeshes;
+        int index = static_cast<int>(data.nodes.size());
+        data.nodes.push_back(modelNode);
+
         // process each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            unsigned int sceneMesh = node->mMeshes[i];
+            if (converted[sceneMesh] < 0)
+            {
+                converted[sceneMesh] = static_cast<int>(data.meshes.size());
+                data.meshes.push_back(processMesh(scene->mMeshes[sceneMesh], scene));
+            }
+            data.nodeMeshes.push_back(static_cast<unsigned int>(converted[sceneMesh]));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, data, index, converted);
         }
 
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    static MeshData processMesh(aiMesh* mesh, const aiScene* scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        vector<Texture>& textures = data.textures;
 
         // walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -132,7 +671,12 @@ private:
                 vertex.Bitangent = vector;
             }
             else
+            {
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                // keep the unused attributes deterministic, vertex welding compares them
+                vertex.Tangent = glm::vec3(0.0f);
+                vertex.Bitangent = glm::vec3(0.0f);
+            }
 
             vertices.push_back(vertex);
         }
@@ -166,82 +710,207 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return the extracted mesh data, the GL objects are created later on upload
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    // collects all material textures of a given type. Only type and path are filled in here,
+    // the images are decoded by loadImages and uploaded (once per path) by loadTexture.
+    static vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
     {
         vector<Texture> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
-            }
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
         }
         return textures;
     }
-};
 
+    // decodes every texture referenced by the meshes, once per path, skipping the ones another model already uploaded.
+    // With a pool the images are decoded in parallel.
+    static void loadImages(ModelData& data, ThreadPool* pool)
+    {
+        vector<pair<string, ImageData*>> pending; // filename and the map slot it decodes into
+        for (const MeshData& mesh : data.meshes)
+        {
+            for (const Texture& texture : mesh.textures)
+            {
+                string filename = data.directory + '/' + texture.path;
+                if (data.images.count(texture.path) == 0 && !TextureCache::get().isLoaded(filename, data.gamma))
+                    pending.emplace_back(filename, &data.images[texture.path]);
+            }
+        }
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
-{
-    string filename = string(path);
-    filename = directory + '/' + filename;
+        // every decode writes only its own slot, the map itself isn't touched while the workers run
+        auto decode = [&pending](size_t i) { *pending[i].second = decodeImage(pending[i].first); };
+        if (pool)
+            pool->parallelFor(pending.size(), decode);
+        else
+            for (size_t i = 0; i < pending.size(); i++)
+                decode(i);
+    }
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    // welds and reorders the imported meshes (see meshOptimizer.h), printing the vertex cache statistics of each
+    static void optimizeMeshes(ModelData& data, ThreadPool* pool)
+    {
+        vector<string> report(data.meshes.size());
+        auto optimize = [&data, &report](size_t i) { report[i] = optimizeMesh(data.meshes[i], "mesh " + to_string(i)); };
+        if (pool)
+            pool->parallelFor(data.meshes.size(), optimize);
+        else
+            for (size_t i = 0; i < data.meshes.size(); i++)
+                optimize(i);
+        cout << "Optimized " << data.path << " (post-transform cache: 16 entry FIFO):" << endl;
+        for (const string& line : report)
+            cout << line << endl;
+    }
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    // builds the simplified LOD index lists of every mesh (see meshSimplifier.h) and prints their triangle counts
+    static void buildLods(ModelData& data, ThreadPool* pool)
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+        auto build = [&data](size_t i) { generateLods(data.meshes[i]); };
+        if (pool)
+            pool->parallelFor(data.meshes.size(), build);
+        else
+            for (size_t i = 0; i < data.meshes.size(); i++)
+                build(i);
+        for (size_t i = 0; i < data.meshes.size(); i++)
+        {
+            cout << "  mesh " << i << " LODs: " << data.meshes[i].indexCount() / 3;
+            for (const MeshLod& lod : data.meshes[i].lods)
+                cout << " -> " << lod.indexCount / 3 << " (error " << lod.error << ")";
+            cout << " triangles" << endl;
+        }
+    }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // AABB and bounding sphere of each mesh and of the whole model, for culling and LOD selection
+    static void computeBounds(ModelData& data)
+    {
+        for (MeshData& mesh : data.meshes)
+            if (mesh.vertexCount() > 0)
+                mesh.bounds = ::computeBounds(&mesh.vertexData()->Position, mesh.vertexCount(), sizeof(Vertex));
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // the model's are in model space, with each mesh placed by the rest pose of every node that references it
+        vector<glm::mat4> transforms = restPose(data.nodes);
+        bool first = true;
+        for (size_t node = 0; node < data.nodes.size(); node++)
+        {
+            for (unsigned int r = data.nodes[node].firstMesh; r < data.nodes[node].firstMesh + data.nodes[node].meshCount; r++)
+            {
+                unsigned int i = data.nodeMeshes[r];
+                if (data.meshes[i].vertexCount() == 0)
+                    continue;
+                glm::vec3 center, extent;
+                transformBounds(data.meshes[i].bounds, transforms[node], center, extent);
+                data.bounds.minimum = first ? center - extent : glm::min(data.bounds.minimum, center - extent);
+                data.bounds.maximum = first ? center + extent : glm::max(data.bounds.maximum, center + extent);
+                first = false;
+            }
+        }
+        data.bounds.center = (data.bounds.minimum + data.bounds.maximum) * 0.5f;
+        // exact over the vertices of meshes referenced once, a mesh referenced by many nodes would cost a vertex pass per
+        // reference, so its own sphere is placed instead
+        vector<unsigned int> references(data.meshes.size(), 0);
+        for (unsigned int mesh : data.nodeMeshes)
+            references[mesh]++;
+        float radiusSquared = 0.0f;
+        for (size_t node = 0; node < data.nodes.size(); node++)
+        {
+            for (unsigned int r = data.nodes[node].firstMesh; r < data.nodes[node].firstMesh + data.nodes[node].meshCount; r++)
+            {
+                const MeshData& mesh = data.meshes[data.nodeMeshes[r]];
+                if (references[data.nodeMeshes[r]] > 1 && mesh.vertexCount() > 0)
+                {
+                    const glm::mat4& transform = transforms[node];
+                    float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+                    float distance = glm::length(glm::vec3(transform * glm::vec4(mesh.bounds.center, 1.0f)) - data.bounds.center) + mesh.bounds.radius * scale;
+                    radiusSquared = std::max(radiusSquared, distance * distance);
+                    continue;
+                }
+                for (size_t v = 0; v < mesh.vertexCount(); v++)
+                {
+                    glm::vec3 offset = glm::vec3(transforms[node] * glm::vec4(mesh.vertexData()[v].Position, 1.0f)) - data.bounds.center;
+                    radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+                }
+            }
+        }
+        data.bounds.radius = std::sqrt(radiusSquared);
+    }
 
-        stbi_image_free(data);
+    // files without a hierarchy (OBJ) get one root node that all meshes hang off
+    static void addRootNode(ModelData& data)
+    {
+        if (!data.nodes.empty())
+            return;
+        ModelNode root;
+        root.meshCount = static_cast<unsigned int>(data.meshes.size());
+        data.nodes.push_back(root);
+        data.nodeMeshes.clear();
+        for (unsigned int i = 0; i < root.meshCount; i++)
+            data.nodeMeshes.push_back(i);
+    }
+
+    // builds the compact vertices for models loaded with VERTEX_FORMAT_PACKED. The full vertices are kept, the mesh cache stores those.
+    static void packMeshes(ModelData& data, ThreadPool* pool)
+    {
+        if (data.vertexFormat != VERTEX_FORMAT_PACKED)
+            return;
+        // quantize against the bounds of the whole model, every mesh is drawn with the same decode uniforms
+        bool first = true;
+        glm::vec3 minimum(0.0f), maximum(0.0f);
+        for (const MeshData& mesh : data.meshes)
+        {
+            for (size_t i = 0; i < mesh.vertexCount(); i++)
+            {
+                const glm::vec3& position = mesh.vertexData()[i].Position;
+                minimum = first ? position : glm::min(minimum, position);
+                maximum = first ? position : glm::max(maximum, position);
+                first = false;
+            }
+        }
+        data.positionOffset = minimum;
+        data.positionScale = maximum - minimum;
+        auto pack = [&data](size_t i) { packVertices(data.meshes[i], data.positionOffset, data.positionScale); };
+        if (pool)
+            pool->parallelFor(data.meshes.size(), pack);
+        else
+            for (size_t i = 0; i < data.meshes.size(); i++)
+                pack(i);
     }
-    else
+
+    // resolves a material texture through the TextureCache, taking one reference per path for this model.
+    // Uses the image decoded by loadImages if there is one, otherwise the cache uploads (or decodes) it here.
+    Texture loadTexture(const Texture& material, const ModelData& data, unordered_map<string, unsigned int>& textureIds)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        Texture texture = material;
+        auto known = textureIds.find(material.path);
+        if (known != textureIds.end())
+        {
+            texture.id = known->second;
+            return texture;
+        }
+        auto image = data.images.find(material.path);
+        const ImageData* decoded = image != data.images.end() ? &image->second : nullptr;
+        texture.id = TextureCache::get().acquire(directory + '/' + material.path, gammaCorrection, decoded);
+        textureIds[material.path] = texture.id;
+        textures_loaded.push_back(texture);
+        return texture;
     }
+};
+
+
+// loads a texture through the TextureCache. The caller owns a reference and has to release it.
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
+{
+    string filename = string(path);
+    filename = directory + '/' + filename;
 
-    return textureID;
+    return TextureCache::get().acquire(filename, gamma);
 }
-#endif#pragma once
+#endif#pragma once
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include "model.h"
+#include "threadPool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Loads models in the background. The Assimp import (or cache read) and the texture decoding run on the thread pool,
+// the finished CPU-side data is queued up and handed to the render thread by poll(), which only has to do the GL upload.
+class ModelLoader
+{
+public:
+    explicit ModelLoader(ThreadPool& pool) : pool(pool) {}
+
+    // waits for requests that are still running, their jobs reference this loader
+    ~ModelLoader()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return inFlight == 0; });
+    }
+
+    ModelLoader(const ModelLoader&) = delete;
+    ModelLoader& operator=(const ModelLoader&) = delete;
+
+    // queues a model for loading and returns a ticket identifying the request
+    unsigned int request(const std::string& path, VertexFormat vertexFormat = VERTEX_FORMAT_FULL)
+    {
+        unsigned int ticket;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ticket = ++lastTicket;
+            inFlight++;
+        }
+        pool.submit([this, path, ticket, vertexFormat]
+        {
+            auto data = std::make_unique<ModelData>(Model::loadData(path, false, &pool, vertexFormat));
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.emplace_back(ticket, std::move(data));
+            inFlight--;
+            idle.notify_all();
+        });
+        return ticket;
+    }
+
+    // pops one finished request, returns false if none is ready. Call from the render thread and upload the data there.
+    bool poll(unsigned int& ticket, std::unique_ptr<ModelData>& data)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished.empty())
+            return false;
+        ticket = finished.front().first;
+        data = std::move(finished.front().second);
+        finished.pop_front();
+        return true;
+    }
+
+    // blocks until the given request has finished and returns its data, for loads that are needed right away (startup)
+    std::unique_ptr<ModelData> wait(unsigned int ticket)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            for (auto it = finished.begin(); it != finished.end(); ++it)
+            {
+                if (it->first == ticket)
+                {
+                    std::unique_ptr<ModelData> data = std::move(it->second);
+                    finished.erase(it);
+                    return data;
+                }
+            }
+            idle.wait(lock);
+        }
+    }
+
+    // true while any request is still being loaded
+    bool busy()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return inFlight > 0;
+    }
+
+private:
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::deque<std::pair<unsigned int, std::unique_ptr<ModelData>>> finished;
+    unsigned int lastTicket = 0;
+    unsigned int inFlight = 0;
+};
+#endif
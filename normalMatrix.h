@@ -0,0 +1,24 @@
+#ifndef NORMAL_MATRIX_H
+#define NORMAL_MATRIX_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// the matrix that transforms normals for a model matrix, transpose(inverse(mat3(model))), computed once per object on
+// the CPU instead of per vertex in the shader. Rotations with a uniform scale, which is most of what the scene uses,
+// skip the inverse: for M = s * R it is R / s, i.e. M / s^2.
+inline glm::mat3 normalMatrix(const glm::mat4& model)
+{
+    glm::mat3 linear(model);
+    float scale0 = glm::dot(linear[0], linear[0]);
+    float scale1 = glm::dot(linear[1], linear[1]);
+    float scale2 = glm::dot(linear[2], linear[2]);
+    float tolerance = 1e-4f * scale0;
+    if (std::abs(scale0 - scale1) <= tolerance && std::abs(scale0 - scale2) <= tolerance
+        && std::abs(glm::dot(linear[0], linear[1])) <= tolerance && std::abs(glm::dot(linear[0], linear[2])) <= tolerance
+        && std::abs(glm::dot(linear[1], linear[2])) <= tolerance && scale0 > 0.0f)
+        return linear * (1.0f / scale0);
+    return glm::transpose(glm::inverse(linear));
+}
+#endif
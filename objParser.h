@@ -0,0 +1,533 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include "mesh.h"
+#include "meshCache.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Wavefront OBJ/MTL reader for the fast path of Model::loadData. The file is memory-mapped and split into chunks at line
+// boundaries that are parsed in parallel, then merged into MeshData with the same conventions as the Assimp import:
+// one mesh per object/group/material, triangulated, UVs flipped, smooth normals and tangents generated when missing.
+// Anything it doesn't understand makes parseObj return false so the caller can fall back to Assimp.
+
+// true if the 8 bytes are all ASCII digits
+inline bool objIsEightDigits(uint64_t chunk)
+{
+    return (((chunk + 0x4646464646464646ull) | (chunk - 0x3030303030303030ull)) & 0x8080808080808080ull) == 0;
+}
+
+// converts 8 ASCII digits at once (SWAR: the bytes of a 64-bit register as lanes), first digit in the lowest byte
+inline uint32_t objParseEightDigits(uint64_t chunk)
+{
+    chunk -= 0x3030303030303030ull;
+    chunk = (chunk * 10) + (chunk >> 8); // pairs of digits
+    chunk = (((chunk & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) + (((chunk >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return static_cast<uint32_t>(chunk);
+}
+
+// appends the decimal digits at p to mantissa, eight at a time while they last. Returns the number of digits read.
+inline int objReadDigits(const char*& p, const char* end, uint64_t& mantissa, int& dropped)
+{
+    int count = 0;
+    while (end - p >= 8 && mantissa < 100000000000ull) // 8 more digits still fit into 19
+    {
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        if (!objIsEightDigits(chunk))
+            break;
+        mantissa = mantissa * 100000000 + objParseEightDigits(chunk);
+        p += 8;
+        count += 8;
+    }
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (mantissa < 1000000000000000000ull)
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+        else
+            dropped++; // beyond float precision anyway
+        p++;
+        count++;
+    }
+    return count;
+}
+
+// parses a float in the usual OBJ notations ("-1.5", ".25", "3e-4"). Falls back to strtod for what the fast path can't round exactly.
+inline bool objParseFloat(const char*& p, const char* end, float& value)
+{
+    static const double POWERS[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int dropped = 0;
+    int digits = objReadDigits(p, end, mantissa, dropped);
+    int exponent = dropped;
+    if (p < end && *p == '.')
+    {
+        p++;
+        int fractionDropped = 0;
+        int fractionDigits = objReadDigits(p, end, mantissa, fractionDropped);
+        digits += fractionDigits;
+        exponent -= fractionDigits - fractionDropped;
+    }
+    if (digits == 0)
+    {
+        p = start;
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* exponentStart = p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negativeExponent = *p++ == '-';
+        int explicitExponent = 0;
+        if (p == end || *p < '0' || *p > '9')
+            p = exponentStart; // not an exponent after all
+        while (p < end && *p >= '0' && *p <= '9')
+            explicitExponent = std::min(explicitExponent * 10 + (*p++ - '0'), 10000);
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+
+    double result;
+    if (mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+        result = exponent < 0 ? double(mantissa) / POWERS[-exponent] : double(mantissa) * POWERS[exponent];
+    else
+    {
+        char buffer[64];
+        size_t length = std::min<size_t>(size_t(p - start), sizeof(buffer) - 1);
+        memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        result = fabs(strtod(buffer, nullptr));
+    }
+    value = float(negative ? -result : result);
+    return true;
+}
+
+inline bool objParseInt(const char*& p, const char* end, int& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p == end || *p < '0' || *p > '9')
+        return false;
+    int result = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        result = result * 10 + (*p++ - '0');
+    value = negative ? -result : result;
+    return true;
+}
+
+// what one thread pulls out of its part of the file. Face corners keep the file's 1-based indices, except that relative
+// (negative) ones are stored as their position in this chunk's list minus RELATIVE_BIAS (which may reach back into
+// earlier chunks) and resolved once the chunk offsets are known.
+struct ObjChunk
+{
+    struct Event
+    {
+        size_t triangle; // the event applies from this triangle of the chunk on
+        bool material;   // usemtl, otherwise o/g
+        string name;
+    };
+
+    static const int64_t RELATIVE_BIAS = int64_t(1) << 40;
+
+    vector<float> positions, normals, texCoords;
+    vector<int64_t> corners; // v, vt, vn per triangle corner, 0 = not given
+    vector<Event> events;
+    vector<string> materialLibraries;
+    bool failed = false;
+};
+
+inline string objRestOfLine(const char* p, const char* lineEnd)
+{
+    while (p < lineEnd && (*p == ' ' || *p == '\t'))
+        p++;
+    while (lineEnd > p && (lineEnd[-1] == ' ' || lineEnd[-1] == '\t' || lineEnd[-1] == '\r'))
+        lineEnd--;
+    return string(p, lineEnd);
+}
+
+inline void objParseChunk(const char* begin, const char* end, ObjChunk& chunk)
+{
+    vector<int64_t> face;
+    for (const char* line = begin; line < end && !chunk.failed;)
+    {
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', size_t(end - line)));
+        if (!lineEnd)
+            lineEnd = end;
+        const char* p = line;
+        line = lineEnd + 1;
+        while (p < lineEnd && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p == lineEnd || *p == '#' || *p == '\r')
+            continue;
+
+        if (p[0] == 'v' && p + 1 < lineEnd && (p[1] == ' ' || p[1] == '\t'))
+        {
+            p += 1;
+            float x, y, z;
+            if (!objParseFloat(p, lineEnd, x) || !objParseFloat(p, lineEnd, y) || !objParseFloat(p, lineEnd, z))
+                chunk.failed = true;
+            chunk.positions.insert(chunk.positions.end(), { x, y, z });
+        }
+        else if (p[0] == 'v' && p + 2 < lineEnd && p[1] == 'n')
+        {
+            p += 2;
+            float x, y, z;
+            if (!objParseFloat(p, lineEnd, x) || !objParseFloat(p, lineEnd, y) || !objParseFloat(p, lineEnd, z))
+                chunk.failed = true;
+            chunk.normals.insert(chunk.normals.end(), { x, y, z });
+        }
+        else if (p[0] == 'v' && p + 2 < lineEnd && p[1] == 't')
+        {
+            p += 2;
+            float u, v = 0.0f;
+            if (!objParseFloat(p, lineEnd, u))
+                chunk.failed = true;
+            objParseFloat(p, lineEnd, v); // 1D texture coordinates leave out v
+            chunk.texCoords.insert(chunk.texCoords.end(), { u, v });
+        }
+        else if (p[0] == 'f' && p + 1 < lineEnd && (p[1] == ' ' || p[1] == '\t'))
+        {
+            p += 1;
+            face.clear();
+            for (;;)
+            {
+                while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+                    p++;
+                if (p == lineEnd)
+                    break;
+                int corner[3] = { 0, 0, 0 };
+                if (!objParseInt(p, lineEnd, corner[0]))
+                {
+                    chunk.failed = true;
+                    break;
+                }
+                for (int k = 1; k < 3 && p < lineEnd && *p == '/'; k++)
+                {
+                    p++;
+                    if (p < lineEnd && *p != '/')
+                        objParseInt(p, lineEnd, corner[k]);
+                }
+                // relative indices count back from the end of this chunk's lists so far
+                int64_t counts[3] = { int64_t(chunk.positions.size() / 3), int64_t(chunk.texCoords.size() / 2), int64_t(chunk.normals.size() / 3) };
+                for (int k = 0; k < 3; k++)
+                    face.push_back(corner[k] < 0 ? counts[k] + corner[k] - ObjChunk::RELATIVE_BIAS : corner[k]);
+            }
+            // triangulate as a fan, like aiProcess_Triangulate does for convex polygons
+            for (size_t i = 2; i < face.size() / 3; i++)
+            {
+                chunk.corners.insert(chunk.corners.end(), face.begin(), face.begin() + 3);
+                chunk.corners.insert(chunk.corners.end(), face.begin() + (i - 1) * 3, face.begin() + i * 3 + 3);
+            }
+        }
+        else if (lineEnd - p > 6 && strncmp(p, "usemtl", 6) == 0)
+            chunk.events.push_back({ chunk.corners.size() / 9, true, objRestOfLine(p + 6, lineEnd) });
+        else if ((p[0] == 'o' || p[0] == 'g') && p + 1 < lineEnd && (p[1] == ' ' || p[1] == '\t'))
+            chunk.events.push_back({ chunk.corners.size() / 9, false, objRestOfLine(p + 1, lineEnd) });
+        else if (lineEnd - p > 6 && strncmp(p, "mtllib", 6) == 0)
+            chunk.materialLibraries.push_back(objRestOfLine(p + 6, lineEnd));
+        // s, l, p and anything else are ignored, like the Assimp import ignores them for our purposes
+    }
+}
+
+// the texture maps of an .mtl material, in the slots processMesh fills from Assimp's texture types
+struct ObjMaterial
+{
+    string diffuse;  // map_Kd
+    string specular; // map_Ks
+    string normal;   // map_Bump / bump (Assimp reports these as aiTextureType_HEIGHT)
+    string height;   // map_Ka (aiTextureType_AMBIENT)
+};
+
+inline void objParseMaterials(const string& path, unordered_map<string, ObjMaterial>& materials)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        std::cout << "ERROR::OBJ:: could not open material library " << path << std::endl;
+        return;
+    }
+    const char* p = reinterpret_cast<const char*>(file.data());
+    const char* end = p + file.size();
+    ObjMaterial* current = nullptr;
+    while (p < end)
+    {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+        if (!lineEnd)
+            lineEnd = end;
+        string line = objRestOfLine(p, lineEnd);
+        p = lineEnd + 1;
+
+        size_t split = line.find_first_of(" \t");
+        string keyword = line.substr(0, split);
+        // map statements may carry options ("-bm 0.5 normal.png"), the file name is the last token
+        string argument = split == string::npos ? "" : line.substr(line.find_last_of(" \t") + 1);
+        if (keyword == "newmtl")
+            current = &materials[objRestOfLine(line.c_str() + split, line.c_str() + line.size())];
+        else if (!current)
+            continue;
+        else if (keyword == "map_Kd")
+            current->diffuse = argument;
+        else if (keyword == "map_Ks")
+            current->specular = argument;
+        else if (keyword == "map_Bump" || keyword == "map_bump" || keyword == "bump")
+            current->normal = argument;
+        else if (keyword == "map_Ka")
+            current->height = argument;
+    }
+}
+
+// fills in smooth normals (shared by all corners at the same OBJ position) and tangents for a freshly built mesh.
+// generateNormals / generateTangents say which attributes the file didn't provide.
+inline void objGenerateVertexAttributes(MeshData& mesh, const vector<unsigned int>& positionIndices, bool generateNormals,
+    bool generateTangents)
+{
+    vector<Vertex>& vertices = mesh.vertices;
+    const vector<unsigned int>& indices = mesh.indices;
+    if (generateNormals)
+    {
+        // number the OBJ positions this mesh uses, so the sums don't need a slot for every position in the file
+        unordered_map<unsigned int, unsigned int> slots;
+        vector<unsigned int> slotOf(vertices.size());
+        for (size_t v = 0; v < vertices.size(); v++)
+            slotOf[v] = slots.emplace(positionIndices[v], static_cast<unsigned int>(slots.size())).first->second;
+        vector<glm::vec3> normals(slots.size(), glm::vec3(0.0f));
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            const glm::vec3& a = vertices[indices[t]].Position;
+            const glm::vec3& b = vertices[indices[t + 1]].Position;
+            const glm::vec3& c = vertices[indices[t + 2]].Position;
+            glm::vec3 normal = glm::cross(b - a, c - a); // area weighted
+            for (int k = 0; k < 3; k++)
+                normals[slotOf[indices[t + k]]] += normal;
+        }
+        for (size_t v = 0; v < vertices.size(); v++)
+        {
+            glm::vec3 normal = normals[slotOf[v]];
+            float length = glm::length(normal);
+            vertices[v].Normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+    }
+    if (generateTangents)
+    {
+        vector<glm::vec3> tangents(vertices.size(), glm::vec3(0.0f)), bitangents(vertices.size(), glm::vec3(0.0f));
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            const Vertex& a = vertices[indices[t]];
+            const Vertex& b = vertices[indices[t + 1]];
+            const Vertex& c = vertices[indices[t + 2]];
+            glm::vec3 edge1 = b.Position - a.Position, edge2 = c.Position - a.Position;
+            glm::vec2 uv1 = b.TexCoords - a.TexCoords, uv2 = c.TexCoords - a.TexCoords;
+            float determinant = uv1.x * uv2.y - uv2.x * uv1.y;
+            if (fabsf(determinant) < 1e-12f)
+                continue;
+            float r = 1.0f / determinant;
+            glm::vec3 tangent = (edge1 * uv2.y - edge2 * uv1.y) * r;
+            glm::vec3 bitangent = (edge2 * uv1.x - edge1 * uv2.x) * r;
+            for (int k = 0; k < 3; k++)
+            {
+                tangents[indices[t + k]] += tangent;
+                bitangents[indices[t + k]] += bitangent;
+            }
+        }
+        for (size_t v = 0; v < vertices.size(); v++)
+        {
+            // make the frame orthogonal to the normal
+            glm::vec3 n = vertices[v].Normal;
+            glm::vec3 tangent = tangents[v] - n * glm::dot(n, tangents[v]);
+            glm::vec3 bitangent = bitangents[v] - n * glm::dot(n, bitangents[v]);
+            float tangentLength = glm::length(tangent), bitangentLength = glm::length(bitangent);
+            vertices[v].Tangent = tangentLength > 0.0f ? tangent / tangentLength : glm::vec3(0.0f);
+            vertices[v].Bitangent = bitangentLength > 0.0f ? bitangent / bitangentLength : glm::vec3(0.0f);
+        }
+    }
+}
+
+// Parses an OBJ file (and the .mtl files it references) into meshes. Uses the pool for files big enough to be worth splitting.
+// Returns false if the file can't be read or uses something this parser doesn't handle; meshes is left empty then.
+inline bool parseObj(const string& path, vector<MeshData>& meshes, ThreadPool* pool = nullptr)
+{
+    const size_t MIN_CHUNK_BYTES = 1 << 20;
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    const char* end = begin + file.size();
+
+    // split at line ends into about four chunks per thread, so uneven chunks still balance out
+    size_t threads = pool ? pool->size() + 1 : 1;
+    size_t chunkCount = std::max<size_t>(1, std::min(threads * 4, file.size() / MIN_CHUNK_BYTES));
+    vector<const char*> bounds{ begin };
+    for (size_t i = 1; i < chunkCount; i++)
+    {
+        const char* split = begin + file.size() * i / chunkCount;
+        if (split <= bounds.back())
+            continue;
+        const char* newline = static_cast<const char*>(memchr(split, '\n', size_t(end - split)));
+        if (!newline)
+            break;
+        bounds.push_back(newline + 1);
+    }
+    bounds.push_back(end);
+
+    vector<ObjChunk> chunks(bounds.size() - 1);
+    auto parse = [&](size_t i) { objParseChunk(bounds[i], bounds[i + 1], chunks[i]); };
+    if (pool)
+        pool->parallelFor(chunks.size(), parse);
+    else
+        for (size_t i = 0; i < chunks.size(); i++)
+            parse(i);
+
+    // merge the attribute lists, remembering where each chunk's part starts
+    vector<float> positions, normals, texCoords;
+    vector<size_t> positionBase, normalBase, texCoordBase;
+    for (const ObjChunk& chunk : chunks)
+    {
+        if (chunk.failed)
+        {
+            std::cout << "ERROR::OBJ:: unsupported syntax in " << path << std::endl;
+            return false;
+        }
+        positionBase.push_back(positions.size() / 3);
+        normalBase.push_back(normals.size() / 3);
+        texCoordBase.push_back(texCoords.size() / 2);
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+    }
+
+    unordered_map<string, ObjMaterial> materials;
+    size_t slash = path.find_last_of('/');
+    string directory = slash == string::npos ? string(".") : path.substr(0, slash);
+    for (const ObjChunk& chunk : chunks)
+        for (const string& library : chunk.materialLibraries)
+            objParseMaterials(directory + '/' + library, materials);
+
+    // one mesh per run of triangles with the same object/group and material
+    struct Builder
+    {
+        MeshData mesh;
+        vector<unsigned int> positionIndices;      // OBJ position of every vertex, for smoothing
+        vector<std::array<int64_t, 2>> attributes; // vt, vn of every vertex
+        vector<unsigned int> nextVertex;           // next vertex with the same position, NO_VERTEX at the end
+        bool missingNormals = false;
+        bool hasTexCoords = false;
+    };
+    const unsigned int NO_VERTEX = ~0u;
+    vector<Builder> builders;
+    string material;
+    bool startMesh = true;
+    size_t positionCount = positions.size() / 3, normalCount = normals.size() / 3, texCoordCount = texCoords.size() / 2;
+
+    // corners are deduplicated through a chain of vertices per OBJ position, which is usually one or two long. The
+    // chain heads are shared by all meshes and tagged with the mesh they belong to, so a new mesh needs no clearing.
+    vector<unsigned int> chainMesh(positionCount, NO_VERTEX), chainHead(positionCount);
+
+    for (size_t c = 0; c < chunks.size(); c++)
+    {
+        const ObjChunk& chunk = chunks[c];
+        size_t event = 0;
+        size_t triangleCount = chunk.corners.size() / 9;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (; event < chunk.events.size() && chunk.events[event].triangle == t; event++)
+            {
+                if (chunk.events[event].material)
+                    material = chunk.events[event].name;
+                startMesh = true;
+            }
+            if (startMesh)
+            {
+                builders.emplace_back();
+                auto found = materials.find(material);
+                if (found != materials.end())
+                {
+                    const ObjMaterial& maps = found->second;
+                    const pair<const string*, const char*> slots[] = { { &maps.diffuse, "texture_diffuse" }, { &maps.specular, "texture_specular" },
+                        { &maps.normal, "texture_normal" }, { &maps.height, "texture_height" } };
+                    for (const auto& slot : slots)
+                        if (!slot.first->empty())
+                            builders.back().mesh.textures.push_back({ 0, slot.second, *slot.first });
+                }
+                startMesh = false;
+            }
+            Builder& builder = builders.back();
+            for (int k = 0; k < 3; k++)
+            {
+                const int64_t* corner = &chunk.corners[(t * 3 + k) * 3];
+                // 0-based global indices, -1 when not given
+                int64_t v = corner[0] < 0 ? int64_t(positionBase[c]) + corner[0] + ObjChunk::RELATIVE_BIAS : corner[0] - 1;
+                int64_t vt = corner[1] < 0 ? int64_t(texCoordBase[c]) + corner[1] + ObjChunk::RELATIVE_BIAS : corner[1] - 1;
+                int64_t vn = corner[2] < 0 ? int64_t(normalBase[c]) + corner[2] + ObjChunk::RELATIVE_BIAS : corner[2] - 1;
+                if (v < 0 || v >= int64_t(positionCount) || vt < -1 || vt >= int64_t(texCoordCount) || vn < -1 || vn >= int64_t(normalCount))
+                {
+                    std::cout << "ERROR::OBJ:: index out of range in " << path << std::endl;
+                    return false;
+                }
+                unsigned int meshIndex = static_cast<unsigned int>(builders.size() - 1);
+                unsigned int vertexIndex = chainMesh[v] == meshIndex ? chainHead[v] : NO_VERTEX;
+                while (vertexIndex != NO_VERTEX && (builder.attributes[vertexIndex][0] != vt || builder.attributes[vertexIndex][1] != vn))
+                    vertexIndex = builder.nextVertex[vertexIndex];
+                if (vertexIndex == NO_VERTEX)
+                {
+                    vertexIndex = static_cast<unsigned int>(builder.mesh.vertices.size());
+                    builder.nextVertex.push_back(chainMesh[v] == meshIndex ? chainHead[v] : NO_VERTEX);
+                    chainMesh[v] = meshIndex;
+                    chainHead[v] = vertexIndex;
+                    builder.attributes.push_back({ { vt, vn } });
+
+                    Vertex vertex = {};
+                    vertex.Position = glm::vec3(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]);
+                    vertex.Normal = vn >= 0 ? glm::vec3(normals[vn * 3], normals[vn * 3 + 1], normals[vn * 3 + 2]) : glm::vec3(0.0f);
+                    // flipped like aiProcess_FlipUVs
+                    vertex.TexCoords = vt >= 0 ? glm::vec2(texCoords[vt * 2], 1.0f - texCoords[vt * 2 + 1]) : glm::vec2(0.0f);
+                    vertex.Tangent = glm::vec3(0.0f);
+                    vertex.Bitangent = glm::vec3(0.0f);
+                    builder.mesh.vertices.push_back(vertex);
+                    builder.positionIndices.push_back(static_cast<unsigned int>(v));
+                    builder.missingNormals |= vn < 0;
+                    builder.hasTexCoords |= vt >= 0;
+                }
+                builder.mesh.indices.push_back(vertexIndex);
+            }
+        }
+        // usemtl/o/g after the chunk's last face apply to the next chunk
+        for (; event < chunk.events.size(); event++)
+        {
+            if (chunk.events[event].material)
+                material = chunk.events[event].name;
+            startMesh = true;
+        }
+    }
+
+    for (Builder& builder : builders)
+    {
+        if (builder.mesh.indices.empty())
+            continue;
+        objGenerateVertexAttributes(builder.mesh, builder.positionIndices, builder.missingNormals, builder.hasTexCoords);
+        meshes.push_back(std::move(builder.mesh));
+    }
+    if (meshes.empty())
+    {
+        std::cout << "ERROR::OBJ:: no faces in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
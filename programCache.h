@@ -0,0 +1,221 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include "hash.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// GL 4.1 / ARB_get_program_binary, which the GL 3.3 loader doesn't declare
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// On-disk cache of linked shader programs (glGetProgramBinary/glProgramBinary), so startup and shader switches skip the
+// driver's compiler after the first run. Entries live in cache/programs/, named after the hash of the shader sources,
+// and also record a hash of the driver's vendor/renderer/version strings: a driver update makes them miss, and a
+// binary the driver refuses anyway just means compiling from source. Everything runs on the GL thread.
+class ProgramCache
+{
+public:
+    static ProgramCache& get()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    // loads the entry points and checks that the driver can save binaries. Call once after the GL loader; until then,
+    // or if the driver can't, the cache stays off and programs are always compiled.
+    void init(GLADloadproc load)
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool supported = major > 4 || (major == 4 && minor >= 1) || hasExtension("GL_ARB_get_program_binary");
+        if (supported)
+        {
+            getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(load("glGetProgramBinary"));
+            programBinary = reinterpret_cast<ProgramBinaryProc>(load("glProgramBinary"));
+            programParameteri = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+        }
+        GLint formats = 0;
+        if (supported)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        enabled = getProgramBinary && programBinary && programParameteri && formats > 0;
+
+        std::string driver;
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const GLubyte* text = glGetString(name);
+            driver += text ? reinterpret_cast<const char*>(text) : "";
+            driver += '\n';
+        }
+        driverHash = hashBytes(driver.data(), driver.size());
+        if (!enabled)
+            std::cout << "Program binary cache unavailable, shaders are compiled from source" << std::endl;
+    }
+
+    // key of a program, from everything that goes into compiling it
+    static uint64_t key(const std::string& vertexCode, const std::string& fragmentCode)
+    {
+        uint64_t hash = hashBytes(vertexCode.data(), vertexCode.size());
+        hash = hashBytes("\0", 1, hash); // so moving text from one stage to the other changes the key
+        return hashBytes(fragmentCode.data(), fragmentCode.size(), hash);
+    }
+
+    // tries to fill program (freshly created, nothing attached) from the cache. Returns false on a miss or if the
+    // driver rejects the binary, the caller compiles then.
+    bool load(uint64_t programKey, GLuint program)
+    {
+        if (!enabled)
+            return false;
+        auto start = std::chrono::steady_clock::now();
+        std::ifstream stream(entryPath(programKey), std::ios::binary);
+        if (!stream)
+            return false;
+        EntryHeader header;
+        stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!stream || memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION
+            || header.driverHash != driverHash || header.programKey != programKey || header.length == 0)
+            return false;
+        std::vector<char> binary(header.length);
+        stream.read(binary.data(), binary.size());
+        if (!stream)
+            return false;
+
+        programBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+            return false;
+        hits++;
+        loadMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    // call before linking a program that will be stored, some drivers only keep the binary when asked to
+    void prepare(GLuint program)
+    {
+        if (enabled)
+            programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // saves a successfully linked program under its key
+    void store(uint64_t programKey, GLuint program, float compileMs)
+    {
+        compiles++;
+        this->compileMs += compileMs;
+        if (!enabled)
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        EntryHeader header;
+        memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.driverHash = driverHash;
+        header.programKey = programKey;
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        getProgramBinary(program, length, &written, &header.format, binary.data());
+        header.length = static_cast<uint32_t>(written);
+
+        // same temporary file and rename as the mesh cache, so a crash never leaves a truncated entry behind
+        std::error_code error;
+        std::filesystem::create_directories(CACHE_DIRECTORY, error);
+        std::string path = entryPath(programKey);
+        std::string tempPath = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        {
+            std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+            if (!stream)
+            {
+                std::cout << "ERROR::PROGRAM_CACHE::COULD_NOT_WRITE: " << tempPath << std::endl;
+                return;
+            }
+            stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            stream.write(binary.data(), written);
+            if (!stream)
+                return;
+        }
+        std::filesystem::rename(tempPath, path, error);
+        if (error)
+            std::filesystem::remove(tempPath, error);
+    }
+
+    // numbers for the UI: programs loaded from the cache and compiled from source, and the time each took
+    bool available() const { return enabled; }
+    int hitCount() const { return hits; }
+    int compileCount() const { return compiles; }
+    float averageLoadMs() const { return hits ? loadMs / hits : 0.0f; }
+    float averageCompileMs() const { return compiles ? compileMs / compiles : 0.0f; }
+
+private:
+    typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+    typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+    typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+    static const uint32_t VERSION = 1;
+    static constexpr const char* CACHE_DIRECTORY = "cache/programs";
+    static constexpr char MAGIC[4] = { 'S', 'D', 'P', 'C' };
+
+    struct EntryHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t driverHash;
+        uint64_t programKey;
+        GLenum format;
+        uint32_t length;
+    };
+
+    GetProgramBinaryProc getProgramBinary = nullptr;
+    ProgramBinaryProc programBinary = nullptr;
+    ProgramParameteriProc programParameteri = nullptr;
+    bool enabled = false;
+    uint64_t driverHash = 0;
+    int hits = 0;
+    int compiles = 0;
+    float loadMs = 0.0f;
+    float compileMs = 0.0f;
+
+    ProgramCache() {}
+
+    static bool hasExtension(const char* name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const GLubyte* extension = glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i));
+            if (extension && strcmp(reinterpret_cast<const char*>(extension), name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    static std::string entryPath(uint64_t programKey)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(programKey));
+        return std::string(CACHE_DIRECTORY) + "/" + name;
+    }
+};
+#endif
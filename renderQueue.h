@@ -0,0 +1,227 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "geometryArena.h"
+#include "glState.h"
+#include "instancing.h"
+#include "mesh.h"
+#include "normalMatrix.h"
+#include "shader_s.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// passes run in this order, each by its own execute() call so the caller can change framebuffers in between
+enum RenderPass
+{
+    RENDER_PASS_SCENE,    // opaque geometry into the offscreen framebuffer, or into the G-buffer when deferred
+    RENDER_PASS_LIGHTING, // deferred only: full screen lighting from the G-buffer into the offscreen framebuffer
+    RENDER_PASS_FORWARD,  // deferred only: unlit geometry over the lit image
+    RENDER_PASS_POST,     // full screen post-processing
+    RENDER_PASS_COUNT
+};
+
+// one draw call with everything needed to issue it
+struct DrawItem
+{
+    uint64_t key = 0;
+    Shader* shader = nullptr;
+    const GeometryArena* arena = nullptr;
+    const DrawBatch* batch = nullptr;   // drawn with one multi-draw if set, otherwise range is drawn
+    ArenaRange range;
+    const Mesh* material = nullptr;     // textures to bind, or
+    GLuint texture = 0;                 // a single texture for unit 0 if there is no material
+    glm::mat4 transform = glm::mat4(1.0f);
+    glm::mat3 normalMatrix = glm::mat3(1.0f); // normalMatrix(transform)
+    bool hasTransform = false;          // sets the "model" and "normalMatrix" uniforms
+    InstanceBuffer* instances = nullptr; // draws every instance in it, for shaders built with INSTANCED
+    // vertex decode of the model the draw belongs to, identity for full vertices
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    bool octahedralNormals = false;
+};
+
+// Draws submitted during a frame, sorted by a 64-bit key and issued in that order so that draws sharing a program,
+// textures and VAO run back to back. The key is, from the most significant bit:
+//   pass (4) | program (8) | material (16) | VAO (12) | depth (24)
+// Programs, materials and VAOs get small ids in the order they are first submitted each frame, depth is the view
+// distance, nearest first, so the depth test rejects as much as it can. The sort is an LSD radix sort over the keys
+// that skips digits every key has in common, usually most of them. Per-frame uniforms of a program have to be set
+// before execute(); per draw only the transform and the vertex decode are set, and only when they change.
+class RenderQueue
+{
+public:
+    // counts of the last executed frame, for the UI
+    struct Stats
+    {
+        int draws = 0;
+        int programSwitches = 0;
+        int materialSwitches = 0;
+        int vertexArraySwitches = 0;
+        int instances = 0; // drawn by instanced draws
+    };
+
+    void clear()
+    {
+        items.clear();
+        programIds.clear();
+        materialIds.clear();
+        arenaIds.clear();
+        lastStats = stats;
+        stats = Stats();
+    }
+
+    // depth is the distance from the camera along the view direction, only used for ordering within a batch
+    void submit(RenderPass pass, DrawItem item, float depth = 0.0f)
+    {
+        GLuint materialKey = item.material ? (item.material->textures.empty() ? 0 : item.material->textures[0].id) : item.texture;
+        float normalizedDepth = std::min(std::max(depth / MAX_DEPTH, 0.0f), 1.0f);
+        item.key = (uint64_t(pass) << 60)
+            | (uint64_t(denseId(programIds, item.shader->ID, 0xFF)) << 52)
+            | (uint64_t(denseId(materialIds, materialKey, 0xFFFF)) << 36)
+            | (uint64_t(denseId(arenaIds, reinterpret_cast<uintptr_t>(item.arena) ^ (reinterpret_cast<uintptr_t>(item.instances) << 1), 0xFFF)) << 24)
+            | uint64_t(normalizedDepth * 0xFFFFFF);
+        items.push_back(item);
+    }
+
+    // sorts everything submitted since clear(); call once per frame before the first execute()
+    void sort()
+    {
+        keys.resize(items.size());
+        for (size_t i = 0; i < items.size(); i++)
+            keys[i] = { items[i].key, static_cast<uint32_t>(i) };
+        radixSort(keys, scratch);
+    }
+
+    // issues the sorted draws of one pass
+    void execute(RenderPass pass)
+    {
+        static constexpr UniformId MODEL("model");
+        static constexpr UniformId NORMAL_MATRIX("normalMatrix");
+        static constexpr UniformId POSITION_OFFSET("positionOffset");
+        static constexpr UniformId POSITION_SCALE("positionScale");
+        static constexpr UniformId OCTAHEDRAL_NORMALS("octahedralNormals");
+        Shader* shader = nullptr;
+        const GeometryArena* arena = nullptr;
+        const InstanceBuffer* instances = nullptr;
+        const Mesh* material = nullptr;
+        GLuint texture = 0;
+        for (const SortKey& sortKey : keys)
+        {
+            if ((sortKey.key >> 60) != uint64_t(pass))
+                continue;
+            const DrawItem& item = items[sortKey.item];
+            bool newProgram = item.shader != shader;
+            if (newProgram)
+            {
+                shader = item.shader;
+                shader->use();
+                stats.programSwitches++;
+            }
+            if (item.arena != arena || item.instances != instances)
+            {
+                arena = item.arena;
+                instances = item.instances;
+                if (instances)
+                    GlState::get().bindVertexArray(item.instances->vertexArray(*arena));
+                else
+                    arena->bind();
+                stats.vertexArraySwitches++;
+            }
+            // a new program needs its samplers set as well, so the textures are bound again for it
+            if (item.material && (newProgram || !material || (item.material != material && !item.material->sameTextures(*material))))
+            {
+                item.material->bindTextures(*shader);
+                stats.materialSwitches++;
+            }
+            else if (!item.material && (newProgram || material || item.texture != texture))
+            {
+                GlState::get().bindTexture(0, GL_TEXTURE_2D, item.texture);
+                stats.materialSwitches++;
+            }
+            material = item.material;
+            texture = item.texture;
+
+            // the value filter in Shader drops these when they are the same as for the last draw
+            shader->set(shader->uniform(POSITION_OFFSET), item.positionOffset);
+            shader->set(shader->uniform(POSITION_SCALE), item.positionScale);
+            shader->set(shader->uniform(OCTAHEDRAL_NORMALS), item.octahedralNormals);
+            if (item.hasTransform)
+            {
+                shader->set(shader->uniform(MODEL), item.transform);
+                shader->set(shader->uniform(NORMAL_MATRIX), item.normalMatrix);
+            }
+
+            if (instances)
+            {
+                GLsizei count = static_cast<GLsizei>(instances->size());
+                if (item.batch)
+                    arena->drawInstanced(*item.batch, count);
+                else
+                    arena->drawInstanced(item.range, count);
+                stats.instances += count;
+            }
+            else if (item.batch)
+                arena->draw(*item.batch);
+            else
+                arena->draw(item.range);
+            stats.draws++;
+        }
+    }
+
+    const Stats& lastFrameStats() const { return lastStats; }
+    size_t size() const { return items.size(); }
+
+    // sort key and the index of the item it belongs to
+    struct SortKey
+    {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    // stable LSD radix sort by key, 8 bits per pass. Passes over a byte that is the same in every key are skipped.
+    static void radixSort(std::vector<SortKey>& keys, std::vector<SortKey>& scratch)
+    {
+        scratch.resize(keys.size());
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t counts[256] = {};
+            for (const SortKey& key : keys)
+                counts[(key.key >> shift) & 0xFF]++;
+            if (keys.empty() || counts[(keys[0].key >> shift) & 0xFF] == keys.size())
+                continue;
+            size_t offset = 0;
+            for (size_t& count : counts)
+            {
+                size_t start = offset;
+                offset += count;
+                count = start;
+            }
+            for (const SortKey& key : keys)
+                scratch[counts[(key.key >> shift) & 0xFF]++] = key;
+            keys.swap(scratch);
+        }
+    }
+
+private:
+    static constexpr float MAX_DEPTH = 1000.0f; // view distance mapped to the largest depth key
+
+    std::vector<DrawItem> items;
+    std::vector<SortKey> keys, scratch;
+    std::unordered_map<uint64_t, uint32_t> programIds, materialIds, arenaIds;
+    Stats stats, lastStats;
+
+    // small id for value, in the order values are first seen this frame. Ids past the field width share the last one,
+    // which only costs ordering, not correctness.
+    static uint32_t denseId(std::unordered_map<uint64_t, uint32_t>& ids, uint64_t value, uint32_t maxId)
+    {
+        auto inserted = ids.emplace(value, static_cast<uint32_t>(ids.size()));
+        return std::min(inserted.first->second, maxId);
+    }
+};
+#endif
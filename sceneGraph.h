@@ -0,0 +1,143 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Transform hierarchy kept as flat arrays, one per field (parent, position, rotation, scale, world matrix, flags).
+// Nodes are only appended and a parent has to exist before its children, so every parent comes before its children
+// and one forward pass over the arrays updates the whole graph. Setting a local transform marks the node dirty;
+// update() starts at the first dirty node and recomputes the world matrix of dirty nodes and of nodes whose parent
+// changed in the same pass, so an unchanged subtree costs one flag test per node and an unchanged graph costs nothing.
+class SceneGraph
+{
+public:
+    static const int NO_PARENT = -1;
+
+    // adds a node under parent (NO_PARENT for a root) and returns its index
+    int add(int parent, const glm::vec3& position = glm::vec3(0.0f), const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f))
+    {
+        int node = static_cast<int>(parents.size());
+        parents.push_back(parent);
+        positions.push_back(position);
+        rotations.push_back(rotation);
+        scales.push_back(scale);
+        worlds.push_back(glm::mat4(1.0f));
+        dirty.push_back(0);
+        changedIn.push_back(0);
+        markDirty(node);
+        return node;
+    }
+
+    void reserve(size_t count)
+    {
+        parents.reserve(count);
+        positions.reserve(count);
+        rotations.reserve(count);
+        scales.reserve(count);
+        worlds.reserve(count);
+        dirty.reserve(count);
+        changedIn.reserve(count);
+    }
+
+    void clear()
+    {
+        parents.clear();
+        positions.clear();
+        rotations.clear();
+        scales.clear();
+        worlds.clear();
+        dirty.clear();
+        changedIn.clear();
+        firstDirty = NONE_DIRTY;
+    }
+
+    size_t size() const { return parents.size(); }
+
+    void setPosition(int node, const glm::vec3& position)
+    {
+        positions[node] = position;
+        markDirty(node);
+    }
+
+    void setRotation(int node, const glm::quat& rotation)
+    {
+        rotations[node] = rotation;
+        markDirty(node);
+    }
+
+    void setScale(int node, const glm::vec3& scale)
+    {
+        scales[node] = scale;
+        markDirty(node);
+    }
+
+    int parent(int node) const { return parents[node]; }
+    const glm::vec3& position(int node) const { return positions[node]; }
+    const glm::quat& rotation(int node) const { return rotations[node]; }
+    const glm::vec3& scale(int node) const { return scales[node]; }
+
+    // valid after the update() that follows the last change
+    const glm::mat4& world(int node) const { return worlds[node]; }
+
+    // whether the last update() recomputed the node's world matrix
+    bool changed(int node) const { return changedIn[node] == updateCount; }
+
+    // recomputes the world matrices that are out of date and returns how many it recomputed
+    size_t update()
+    {
+        updateCount++;
+        if (firstDirty == NONE_DIRTY)
+            return 0;
+        size_t recomputed = 0;
+        for (size_t node = firstDirty; node < parents.size(); node++)
+        {
+            int parent = parents[node];
+            if (!dirty[node] && (parent == NO_PARENT || changedIn[parent] != updateCount))
+                continue;
+            glm::mat4 local = localMatrix(positions[node], rotations[node], scales[node]);
+            worlds[node] = parent == NO_PARENT ? local : worlds[parent] * local;
+            dirty[node] = 0;
+            changedIn[node] = updateCount;
+            recomputed++;
+        }
+        firstDirty = NONE_DIRTY;
+        return recomputed;
+    }
+
+    // translate * rotate * scale without the three matrix products
+    static glm::mat4 localMatrix(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+    {
+        glm::mat4 local = glm::mat4_cast(rotation);
+        local[0] *= scale.x;
+        local[1] *= scale.y;
+        local[2] *= scale.z;
+        local[3] = glm::vec4(position, 1.0f);
+        return local;
+    }
+
+private:
+    static const size_t NONE_DIRTY = SIZE_MAX;
+
+    std::vector<int> parents;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> dirty;       // local transform changed since the last update
+    std::vector<uint32_t> changedIn;  // the update that last recomputed the world matrix, so no flags need clearing
+    size_t firstDirty = NONE_DIRTY;
+    uint32_t updateCount = 1;
+
+    void markDirty(int node)
+    {
+        dirty[node] = 1;
+        if (static_cast<size_t>(node) < firstDirty)
+            firstDirty = static_cast<size_t>(node);
+    }
+};
+#endif
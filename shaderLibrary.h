@@ -0,0 +1,215 @@
+#ifndef SHADER_LIBRARY_H
+#define SHADER_LIBRARY_H
+
+#include <glad/glad.h>
+
+#include "shader_s.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// GL_KHR_parallel_shader_compile, which the GL 3.3 loader doesn't declare
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Every selectable shader, compiled up front so switching effects is only a pointer swap. With
+// GL_KHR_parallel_shader_compile (or the ARB version) the programs are handed to the driver's compiler threads at startup and
+// picked up by update() once GL_COMPLETION_STATUS_KHR says they are done; without it they are all finished during startup.
+// Shaders from the program cache are ready right away either way. reload() rebuilds the shaders whose files changed on
+// disk the same way, without touching the programs in use until their replacement has linked. Everything runs on the
+// GL thread.
+class ShaderLibrary
+{
+public:
+    // load is the GL loader, for the parallel compile entry point
+    explicit ShaderLibrary(GLADloadproc load)
+    {
+        startTime = std::chrono::steady_clock::now();
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count && !parallelCompile; i++)
+        {
+            const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+            parallelCompile = extension && (strcmp(extension, "GL_KHR_parallel_shader_compile") == 0 || strcmp(extension, "GL_ARB_parallel_shader_compile") == 0);
+        }
+        if (parallelCompile)
+        {
+            // let the driver use as many compiler threads as it likes
+            typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+            MaxShaderCompilerThreadsProc maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsKHR"));
+            if (!maxThreads)
+                maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsARB"));
+            if (maxThreads)
+                maxThreads(0xFFFFFFFFu);
+        }
+    }
+
+    ShaderLibrary(const ShaderLibrary&) = delete;
+    ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+    // starts building a shader and returns its index for get(). Each variant (the files plus the define set) is only
+    // built once, asking for it again returns the existing index. Can also be called after startup, e.g. when a knob
+    // asks for a new variant; ready() tells when it can be switched to without waiting.
+    int add(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines = ShaderDefines())
+    {
+        std::string key = std::string(vertexPath) + "|" + fragmentPath + "|" + shaderDefinesKey(defines);
+        for (size_t i = 0; i < keys.size(); i++)
+            if (keys[i] == key)
+                return static_cast<int>(i);
+        if (allReady)
+            std::cout << "Building shader variant " << fragmentPath << " " << shaderDefinesKey(defines) << std::endl;
+        keys.push_back(key);
+        shaders.push_back(std::make_unique<Shader>(vertexPath, fragmentPath, defines, SHADER_LINK_DEFERRED));
+        if (allReady && !parallelCompile)
+            finishVariant(*shaders.back());
+        return static_cast<int>(shaders.size()) - 1;
+    }
+
+    // call once everything is added: without parallel compile this is where the driver does the work
+    void finishStartup()
+    {
+        if (!parallelCompile)
+            for (std::unique_ptr<Shader>& shader : shaders)
+                shader->finishLink();
+        update();
+        float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << "Shader library: " << shaders.size() << " programs, " << pendingCount() << " still compiling after " << elapsedMs << " ms" << std::endl;
+    }
+
+    // rebuilds every shader that uses one of the changed files, directly or through an #include. The rebuilds compile
+    // like the startup shaders and are swapped in by update() once done, or dropped with their errors logged while the
+    // old program keeps running.
+    void reload(const std::vector<std::string>& changedFiles)
+    {
+        if (changedFiles.empty())
+            return;
+        for (size_t i = 0; i < shaders.size(); i++)
+        {
+            bool affected = false;
+            for (const std::string& file : changedFiles)
+                affected = affected || shaders[i]->dependsOn(file);
+            if (!affected)
+                continue;
+            discardRebuild(static_cast<int>(i)); // saved again while the last save was still compiling
+            Rebuild rebuild;
+            rebuild.index = static_cast<int>(i);
+            rebuild.start = std::chrono::steady_clock::now();
+            const Shader& old = *shaders[i];
+            rebuild.shader = std::make_unique<Shader>(old.vertexSource().c_str(), old.fragmentSource().c_str(), old.sourceDefines(), SHADER_LINK_DEFERRED);
+            rebuilds.push_back(std::move(rebuild));
+        }
+    }
+
+    // finishes the shaders the driver is done with. Call once per frame, never waits.
+    void update()
+    {
+        for (size_t i = 0; i < rebuilds.size();)
+        {
+            Rebuild& rebuild = rebuilds[i];
+            GLint done = GL_TRUE;
+            if (parallelCompile && !rebuild.shader->linked())
+                glGetProgramiv(rebuild.shader->ID, GL_COMPLETION_STATUS_KHR, &done);
+            if (!done)
+            {
+                i++;
+                continue;
+            }
+            Shader& shader = *shaders[rebuild.index];
+            float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - rebuild.start).count();
+            if (shader.reload(*rebuild.shader))
+                std::cout << "Reloaded " << shader.fragmentSource() << " " << shaderDefinesKey(shader.sourceDefines()) << " in " << elapsedMs << " ms" << std::endl;
+            else
+                std::cout << "Reload of " << rebuild.shader->fragmentSource() << " failed, keeping the old program" << std::endl;
+            rebuilds.erase(rebuilds.begin() + i);
+        }
+
+        for (std::unique_ptr<Shader>& shader : shaders)
+        {
+            if (shader->linked())
+                continue;
+            GLint done = GL_TRUE;
+            if (parallelCompile)
+                glGetProgramiv(shader->ID, GL_COMPLETION_STATUS_KHR, &done);
+            if (done)
+                finishVariant(*shader);
+        }
+        if (!allReady && pendingCount() == 0)
+        {
+            allReady = true;
+            readyMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        }
+    }
+
+    // the shader to switch to. Only waits for the driver if it is still compiling this one; how long that took is
+    // reported by lastSwitchMs().
+    Shader* get(int index)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Shader* shader = shaders[index].get();
+        shader->finishLink();
+        lastSwitch = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return shader;
+    }
+
+    // built and linked without errors. A variant that failed is never ready, so the caller keeps the program it has.
+    bool ready(int index) const { return shaders[index]->linked() && shaders[index]->succeeded(); }
+    int reloadingCount() const { return static_cast<int>(rebuilds.size()); }
+
+    int pendingCount() const
+    {
+        int pending = 0;
+        for (const std::unique_ptr<Shader>& shader : shaders)
+            pending += shader->linked() ? 0 : 1;
+        return pending;
+    }
+
+    int size() const { return static_cast<int>(shaders.size()); }
+    bool parallel() const { return parallelCompile; }
+    // time from construction until every shader was finished, 0 while some are still compiling
+    float startupMs() const { return allReady ? readyMs : 0.0f; }
+    float lastSwitchMs() const { return lastSwitch; }
+
+private:
+    std::vector<std::unique_ptr<Shader>> shaders;
+    std::vector<std::string> keys; // vertex path|fragment path|defines of each shader
+    // a new build of shaders[index] after one of its files changed
+    struct Rebuild
+    {
+        int index;
+        std::unique_ptr<Shader> shader;
+        std::chrono::steady_clock::time_point start;
+    };
+    std::vector<Rebuild> rebuilds;
+    bool parallelCompile = false;
+    std::chrono::steady_clock::time_point startTime;
+    bool allReady = false;
+    float readyMs = 0.0f;
+    float lastSwitch = 0.0f;
+
+    void finishVariant(Shader& shader)
+    {
+        shader.finishLink();
+        if (!shader.succeeded())
+            std::cout << "Build of " << shader.fragmentSource() << " " << shaderDefinesKey(shader.sourceDefines()) << " failed, keeping the current program" << std::endl;
+    }
+
+    void discardRebuild(int index)
+    {
+        for (size_t i = 0; i < rebuilds.size(); i++)
+        {
+            if (rebuilds[i].index != index)
+                continue;
+            rebuilds[i].shader->finishLink();
+            GlState::get().forgetProgram(rebuilds[i].shader->ID);
+            glDeleteProgram(rebuilds[i].shader->ID);
+            rebuilds.erase(rebuilds.begin() + i);
+            return;
+        }
+    }
+};
+#endif
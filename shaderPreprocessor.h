@@ -0,0 +1,135 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Source-level preprocessing done before a shader goes to the driver: #include "file" (relative to the including file,
+// each file at most once per shader) and a block of #defines injected right after #version. Shaders give their
+// tunables defaults with #ifndef NAME / #define NAME ... / #endif, so a define set picks a compile-time specialized
+// variant: loops over the constants still unroll and nothing is branched on at runtime.
+
+// name/value pairs, emitted in this order. Different values make a different source and thus a different program.
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+inline std::pair<std::string, std::string> shaderDefine(const std::string& name, int value)
+{
+    return { name, std::to_string(value) };
+}
+
+// floats keep a decimal point so GLSL doesn't take them for ints
+inline std::pair<std::string, std::string> shaderDefine(const std::string& name, float value)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.6g", value);
+    std::string result = text;
+    if (result.find_first_of(".eE") == std::string::npos)
+        result += ".0";
+    return { name, result };
+}
+
+// "NAME=value NAME=value", for logging and as a lookup key
+inline std::string shaderDefinesKey(const ShaderDefines& defines)
+{
+    std::string key;
+    for (const auto& define : defines)
+        key += (key.empty() ? "" : " ") + define.first + "=" + define.second;
+    return key;
+}
+
+inline bool readShaderFile(const std::string& path, std::string& source)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::stringstream stream;
+    stream << file.rdbuf();
+    source = stream.str();
+    return true;
+}
+
+// appends source to out with its #include lines replaced by the included files. #line directives keep the driver's
+// error messages pointing at the right line; the source string number is the file's index in files.
+inline void expandShaderIncludes(const std::string& source, const std::string& path, const ShaderDefines* defines,
+    std::vector<std::string>& files, std::string& out, int depth = 0)
+{
+    const int MAX_DEPTH = 16;
+    int fileIndex = static_cast<int>(files.size());
+    files.push_back(std::filesystem::path(path).lexically_normal().generic_string());
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+
+    std::istringstream stream(source);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(stream, line))
+    {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        size_t start = line.find_first_not_of(" \t");
+        bool directive = start != std::string::npos && line[start] == '#';
+
+        // the defines go right after #version, which has to stay the first statement of the shader
+        if (directive && defines && line.compare(start, 8, "#version") == 0)
+        {
+            out += line + "\n";
+            for (const auto& define : *defines)
+                out += "#define " + define.first + " " + define.second + "\n";
+            out += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+            defines = nullptr;
+            continue;
+        }
+        if (!directive || line.compare(start, 8, "#include") != 0)
+        {
+            out += line + "\n";
+            continue;
+        }
+
+        size_t open = line.find('"', start);
+        size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+        if (close == std::string::npos)
+        {
+            std::cout << "ERROR::SHADER::BAD_INCLUDE: " << path << "(" << lineNumber << ")" << std::endl;
+            out += "\n";
+            continue;
+        }
+        std::string includePath = (directory / line.substr(open + 1, close - open - 1)).lexically_normal().generic_string();
+        bool alreadyIncluded = false;
+        for (const std::string& file : files)
+            alreadyIncluded |= file == includePath;
+        std::string included;
+        if (alreadyIncluded)
+            ; // include guards for free
+        else if (depth >= MAX_DEPTH)
+            std::cout << "ERROR::SHADER::INCLUDE_TOO_DEEP: " << includePath << std::endl;
+        else if (!readShaderFile(includePath, included))
+            std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND: " << includePath << " in " << path << std::endl;
+        else
+        {
+            out += "#line 1 " + std::to_string(files.size()) + "\n";
+            expandShaderIncludes(included, includePath, nullptr, files, out, depth + 1);
+        }
+        out += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+    }
+}
+
+// the source the driver gets for the shader file at path. dependencies, if given, receives the file itself and every
+// file it includes.
+inline std::string preprocessShader(const std::string& source, const std::string& path, const ShaderDefines& defines,
+    std::vector<std::string>* dependencies = nullptr)
+{
+    std::vector<std::string> files;
+    std::string out;
+    out.reserve(source.size() + 256);
+    expandShaderIncludes(source, path, &defines, files, out);
+    if (dependencies)
+        dependencies->insert(dependencies->end(), files.begin(), files.end());
+    return out;
+}
+#endif
@@ -0,0 +1,136 @@
+#ifndef SHADER_WATCHER_H
+#define SHADER_WATCHER_H
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Reports files that changed below a directory, for reloading shaders while the app runs. On Linux it uses inotify,
+// which costs one non-blocking read per poll; elsewhere, or if inotify isn't available, it compares modification times,
+// at most a few times a second. Only call poll() from one thread.
+class ShaderWatcher
+{
+public:
+    explicit ShaderWatcher(const std::string& directory) : root(directory)
+    {
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0)
+        {
+            watchDirectory(root);
+            std::error_code error;
+            for (std::filesystem::recursive_directory_iterator it(root, error), end; !error && it != end; it.increment(error))
+                if (it->is_directory(error))
+                    watchDirectory(it->path().generic_string());
+            return;
+        }
+        std::cout << "ERROR::SHADER_WATCHER::INOTIFY_UNAVAILABLE: watching " << root << " by polling" << std::endl;
+#endif
+        scan(modifiedTimes);
+    }
+
+    ~ShaderWatcher()
+    {
+#ifdef __linux__
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+#endif
+    }
+
+    ShaderWatcher(const ShaderWatcher&) = delete;
+    ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+    // the files written, created or moved in since the last call, each once. Never waits.
+    std::vector<std::string> poll()
+    {
+        std::vector<std::string> changed;
+#ifdef __linux__
+        if (inotifyFd >= 0)
+        {
+            // editors save with a write or with a rename over the old file, so both count. A created file is only
+            // reported once it is closed after writing.
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* next = buffer; next < buffer + length; next += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(next)->len)
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+                    auto directory = watches.find(event->wd);
+                    if (directory == watches.end() || event->len == 0)
+                        continue;
+                    std::string path = directory->second + "/" + event->name;
+                    if (event->mask & IN_ISDIR)
+                    {
+                        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                            watchDirectory(path);
+                    }
+                    else if (!(event->mask & IN_CREATE) && std::find(changed.begin(), changed.end(), path) == changed.end())
+                        changed.push_back(path);
+                }
+            }
+            return changed;
+        }
+#endif
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastScan < std::chrono::milliseconds(250))
+            return changed;
+        lastScan = now;
+        std::map<std::string, std::filesystem::file_time_type> times;
+        scan(times);
+        for (const auto& file : times)
+        {
+            auto previous = modifiedTimes.find(file.first);
+            if (previous == modifiedTimes.end() || previous->second != file.second)
+                changed.push_back(file.first);
+        }
+        modifiedTimes.swap(times);
+        return changed;
+    }
+
+    // false when poll() falls back to comparing modification times
+    bool native() const
+    {
+#ifdef __linux__
+        return inotifyFd >= 0;
+#else
+        return false;
+#endif
+    }
+
+private:
+    std::string root;
+    std::map<std::string, std::filesystem::file_time_type> modifiedTimes; // for the polling fallback
+    std::chrono::steady_clock::time_point lastScan;
+#ifdef __linux__
+    int inotifyFd = -1;
+    std::map<int, std::string> watches; // watch descriptor -> directory
+
+    void watchDirectory(const std::string& directory)
+    {
+        int watch = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (watch < 0)
+            std::cout << "ERROR::SHADER_WATCHER::COULD_NOT_WATCH: " << directory << std::endl;
+        else
+            watches[watch] = directory;
+    }
+#endif
+
+    void scan(std::map<std::string, std::filesystem::file_time_type>& times) const
+    {
+        std::error_code error;
+        for (std::filesystem::recursive_directory_iterator it(root, error), end; !error && it != end; it.increment(error))
+            if (it->is_regular_file(error))
+                times[it->path().generic_string()] = it->last_write_time(error);
+    }
+};
+#endif
@@ -4,21 +4,87 @@
 
 #include <glad/glad.h>
 
+#include "glState.h"
+#include "programCache.h"
+#include "shaderPreprocessor.h"
+
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// 32-bit FNV-1a, constexpr so uniform names written as literals can be hashed by the compiler
+constexpr uint32_t uniformHash(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+        hash = (hash ^ static_cast<unsigned char>(*name++)) * 16777619u;
+    return hash;
+}
+
+// a uniform name as the setters take it. String literals convert implicitly; use a constexpr UniformId
+// ("constexpr UniformId LIGHT_POSITION("light.position");") to be sure the hash is computed at compile time.
+struct UniformId
+{
+    uint32_t hash;
+    constexpr UniformId(const char* name) : hash(uniformHash(name)) {}
+    UniformId(const std::string& name) : hash(uniformHash(name.c_str())) {}
+};
+
+// binding points of the uniform blocks shared by all programs (see uniformBlocks.h). GL 3.3 has no layout(binding = N)
+// for blocks, so every program attaches the blocks it declares by name after linking.
+enum UniformBlockBinding
+{
+    UNIFORM_BLOCK_CAMERA = 0,
+    UNIFORM_BLOCK_LIGHTS = 1,
+    UNIFORM_BLOCK_CLUSTERS = 2
+};
+
+// texture units of the textures shared by all programs, bound once per frame rather than per material. Materials use
+// the units from 0 up, GL 3.3 guarantees 16 per fragment shader.
+enum SharedTextureUnit
+{
+    TEXTURE_UNIT_GBUFFER_ALBEDO = 10,
+    TEXTURE_UNIT_GBUFFER_NORMAL = 11,
+    TEXTURE_UNIT_GBUFFER_DEPTH = 12,
+    TEXTURE_UNIT_CLUSTER_LIGHTS = 13,
+    TEXTURE_UNIT_CLUSTER_RANGES = 14,
+    TEXTURE_UNIT_CLUSTER_INDICES = 15
+};
+
+// when a Shader checks the result of its compile. Deferred shaders can be compiled by the driver in the background
+// (GL_KHR_parallel_shader_compile) and must be finished with finishLink() before use, see ShaderLibrary.
+enum ShaderLink
+{
+    SHADER_LINK_NOW,
+    SHADER_LINK_DEFERRED
+};
+
 
 class Shader
 {
 public:
     unsigned int ID; // save id when generating the shader program
 
-    Shader(const char* vertexPath, const char* fragmentPath)
+    // precomputed handle of an active uniform, from uniform()
+    struct Uniform
+    {
+        int entry = -1;
+    };
+
+    // defines are injected into both stages, see shaderPreprocessor.h
+    Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines = ShaderDefines(), ShaderLink link = SHADER_LINK_NOW)
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -48,76 +114,369 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        // 1 refers to the number of source code strings
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
+        // 2. resolve #includes and add the defines; the program key below then differs per variant
+        this->vertexPath = vertexPath;
+        this->fragmentPath = fragmentPath;
+        this->defines = defines;
+        vertexCode = preprocessShader(vertexCode, vertexPath, defines, &sourceFiles);
+        fragmentCode = preprocessShader(fragmentCode, fragmentPath, defines, &sourceFiles);
+        // 3. reuse the linked program from an earlier run if the driver still accepts it
         ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        programKey = ProgramCache::key(vertexCode, fragmentCode);
+        if (ProgramCache::get().load(programKey, ID))
+        {
+            linkSucceeded = true;
+            linkDone();
+        }
+        else
+        {
+            compile(vertexCode, fragmentCode);
+            if (link == SHADER_LINK_NOW)
+                finishLink();
+        }
+    }
+
+    // whether finishLink() has run, i.e. the program can be used
+    bool linked() const
+    {
+        return finished;
+    }
+
+    // whether it compiled and linked, known once linked() is true
+    bool succeeded() const
+    {
+        return linkSucceeded;
+    }
+
+    // whether file went into this program, directly or through an #include
+    bool dependsOn(const std::string& file) const
+    {
+        std::error_code error;
+        for (const std::string& source : sourceFiles)
+            if (source == file || std::filesystem::equivalent(source, file, error))
+                return true;
+        return false;
+    }
+
+    // what the shader was built from, for building it again
+    const std::string& vertexSource() const { return vertexPath; }
+    const std::string& fragmentSource() const { return fragmentPath; }
+    const ShaderDefines& sourceDefines() const { return defines; }
+
+    // takes over the program of rebuilt, a new build of the same files, if it compiled and linked; otherwise keeps the
+    // current program. Either way rebuilt is left empty. This object stays the same, so pointers to it remain valid,
+    // and uniform values set on the old program are set on the new one as well.
+    bool reload(Shader& rebuilt)
+    {
+        rebuilt.finishLink();
+        if (!rebuilt.linkSucceeded)
+        {
+            GlState::get().forgetProgram(rebuilt.ID);
+            glDeleteProgram(rebuilt.ID);
+            rebuilt.ID = 0;
+            return false;
+        }
+        GLuint current = GlState::get().program();
+        GlState::get().useProgram(rebuilt.ID);
+        for (const auto& entry : uniformEntries)
+        {
+            const UniformSlot& old = uniformSlots[entry.second];
+            auto found = rebuilt.uniformEntries.find(entry.first);
+            if (old.valid && found != rebuilt.uniformEntries.end() && rebuilt.uniformSlots[found->second].type == old.type)
+                rebuilt.restoreUniform(rebuilt.uniformSlots[found->second], old.value);
+        }
+        GlState::get().useProgram(current == ID ? rebuilt.ID : current);
+        GlState::get().forgetProgram(ID);
+        glDeleteProgram(ID);
+        size_t skipped = skippedUploads;
+        *this = std::move(rebuilt);
+        skippedUploads += skipped;
+        rebuilt.ID = 0;
+        return true;
+    }
+
+    // checks the compile and link results of a deferred shader and sets up its uniforms. Waits for the driver if it
+    // is still compiling. Does nothing for shaders that are done already.
+    void finishLink()
+    {
+        if (finished)
+            return;
+        bool compiled = checkCompileErrors(pendingVertex, "VERTEX") & checkCompileErrors(pendingFragment, "FRAGMENT");
+        bool success = checkCompileErrors(ID, "PROGRAM") && compiled;
         // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        glDetachShader(ID, pendingVertex);
+        glDetachShader(ID, pendingFragment);
+        glDeleteShader(pendingVertex);
+        glDeleteShader(pendingFragment);
+        pendingVertex = pendingFragment = 0;
+        linkSucceeded = success;
+        if (success)
+            ProgramCache::get().store(programKey, ID, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - compileStart).count());
+        linkDone();
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use()
     {
-        glUseProgram(ID);
+        GlState::get().useProgram(ID);
     }
+    // looks up an active uniform once, for setters in hot loops. Unknown names give a handle the setters ignore.
+    Uniform uniform(UniformId name) const
+    {
+        Uniform handle;
+        auto found = uniformEntries.find(name.hash);
+        if (found != uniformEntries.end())
+            handle.entry = found->second;
+        return handle;
+    }
+
     // utility uniform functions
+    // the program has to be in use. Names are looked up in the table built at link time, values equal to the last
+    // ones set are not uploaded again, and uniforms the program doesn't use are ignored like with location -1.
     // ------------------------------------------------------------------------
-    void setBool(const std::string& name, bool value) const
+    void setBool(UniformId name, bool value)
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        set(uniform(name), value);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string& name, int value) const
+    void setInt(UniformId name, int value)
+    {
+        set(uniform(name), value);
+    }
+    // ------------------------------------------------------------------------
+    void setFloat(UniformId name, float value)
+    {
+        set(uniform(name), value);
+    }
+
+    void setMat3(UniformId name, const glm::mat3& value)
+    {
+        set(uniform(name), value);
+    }
+
+    void setMat4(UniformId name, const glm::mat4& value)
+    {
+        set(uniform(name), value);
+    }
+
+    void setVec3(UniformId name, float x, float y, float z)
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        set(uniform(name), glm::vec3(x, y, z));
     }
+
+    void setVec3(UniformId name, const glm::vec3& value)
+    {
+        set(uniform(name), value);
+    }
+
+    // the same setters for precomputed handles
     // ------------------------------------------------------------------------
-    void setFloat(const std::string& name, float value) const
+    void set(Uniform handle, bool value)
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        set(handle, (int)value);
     }
 
-    void setMat4(const std::string& name, glm::mat4 value) const 
+    void set(Uniform handle, int value)
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+        if (changed(handle, &value, sizeof(value)))
+            glUniform1i(uniformSlots[handle.entry].location, value);
+    }
+
+    void set(Uniform handle, float value)
+    {
+        if (changed(handle, &value, sizeof(value)))
+            glUniform1f(uniformSlots[handle.entry].location, value);
+    }
+
+    void set(Uniform handle, const glm::vec3& value)
+    {
+        if (changed(handle, glm::value_ptr(value), sizeof(value)))
+            glUniform3fv(uniformSlots[handle.entry].location, 1, glm::value_ptr(value));
+    }
 
+    void set(Uniform handle, const glm::mat3& value)
+    {
+        if (changed(handle, glm::value_ptr(value), sizeof(value)))
+            glUniformMatrix3fv(uniformSlots[handle.entry].location, 1, GL_FALSE, glm::value_ptr(value));
     }
 
-    void setVec3(const std::string& name, float x, float y, float z) const
+    void set(Uniform handle, const glm::mat4& value)
     {
-        // Uses glUniform3f, which takes the uniform location followed by 
-        // the three float components (f1, f2, f3).
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        if (changed(handle, glm::value_ptr(value), sizeof(value)))
+            glUniformMatrix4fv(uniformSlots[handle.entry].location, 1, GL_FALSE, glm::value_ptr(value));
     }
 
-    void setVec3(const std::string& name, glm::vec3 value) const
+    // how many uniform uploads the value filter saved so far
+    size_t skippedUniformUploads() const { return skippedUploads; }
+
+    // forgets the remembered values, needed after uniforms were set with glUniform* directly
+    void invalidateUniformCache()
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+        for (UniformSlot& slot : uniformSlots)
+            slot.valid = false;
     }
 
 private:
+    uint64_t programKey = 0;
+    unsigned int pendingVertex = 0, pendingFragment = 0; // until finishLink()
+    std::chrono::steady_clock::time_point compileStart;
+    bool finished = false;
+    bool linkSucceeded = false;
+    std::string vertexPath, fragmentPath;
+    ShaderDefines defines;
+    std::vector<std::string> sourceFiles; // both stages and their includes
+
+    // starts compiling and linking the program from source. Nothing here waits for the driver; the results are
+    // checked by finishLink(), which also stores the program in the program cache.
+    void compile(const std::string& vertexCode, const std::string& fragmentCode)
+    {
+        compileStart = std::chrono::steady_clock::now();
+        const char* vShaderCode = vertexCode.c_str();
+        const char* fShaderCode = fragmentCode.c_str();
+        // vertex shader
+        pendingVertex = glCreateShader(GL_VERTEX_SHADER);
+        // 1 refers to the number of source code strings
+        glShaderSource(pendingVertex, 1, &vShaderCode, NULL);
+        glCompileShader(pendingVertex);
+        // fragment Shader
+        pendingFragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(pendingFragment, 1, &fShaderCode, NULL);
+        glCompileShader(pendingFragment);
+        // shader Program
+        glAttachShader(ID, pendingVertex);
+        glAttachShader(ID, pendingFragment);
+        ProgramCache::get().prepare(ID);
+        glLinkProgram(ID);
+    }
+
+    void linkDone()
+    {
+        finished = true;
+        reflectUniforms();
+        bindUniformBlock("Camera", UNIFORM_BLOCK_CAMERA);
+        bindUniformBlock("Lights", UNIFORM_BLOCK_LIGHTS);
+        bindUniformBlock("Clusters", UNIFORM_BLOCK_CLUSTERS);
+        bindSampler("clusterLights", TEXTURE_UNIT_CLUSTER_LIGHTS);
+        bindSampler("clusterRanges", TEXTURE_UNIT_CLUSTER_RANGES);
+        bindSampler("clusterLightIndices", TEXTURE_UNIT_CLUSTER_INDICES);
+        bindSampler("gAlbedo", TEXTURE_UNIT_GBUFFER_ALBEDO);
+        bindSampler("gNormal", TEXTURE_UNIT_GBUFFER_NORMAL);
+        bindSampler("gDepth", TEXTURE_UNIT_GBUFFER_DEPTH);
+    }
+
+    // location and last uploaded value of one active uniform (array elements get one each)
+    struct UniformSlot
+    {
+        GLint location = -1;
+        GLenum type = 0;
+        bool valid = false; // false until the first upload
+        unsigned char value[sizeof(glm::mat4)];
+    };
+    std::unordered_map<uint32_t, int> uniformEntries; // name hash -> uniformSlots index
+    std::vector<UniformSlot> uniformSlots;
+    size_t skippedUploads = 0;
+
+    // fills the uniform table from the linked program. Arrays are registered as "name", "name[0]", "name[1]", ...
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> buffer(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, static_cast<GLuint>(i), static_cast<GLsizei>(buffer.size()), nullptr, &size, &type, buffer.data());
+            std::string name = buffer.data();
+            if (name.compare(0, 3, "gl_") == 0)
+                continue;
+            std::string base = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0 ? name.substr(0, name.size() - 3) : name;
+            addUniform(base, glGetUniformLocation(ID, name.c_str()), type);
+            for (GLint element = 0; element < size && base != name; element++)
+            {
+                std::string elementName = base + "[" + std::to_string(element) + "]";
+                addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()), type);
+            }
+        }
+    }
+
+    void bindUniformBlock(const char* name, UniformBlockBinding binding)
+    {
+        GLuint index = glGetUniformBlockIndex(ID, name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+
+    // points a sampler the program declares at its shared unit. Left at 0 it would share unit 0 with the material's
+    // sampler2D, and samplers of different types on one unit fail the draw.
+    void bindSampler(const char* name, SharedTextureUnit unit)
+    {
+        Uniform handle = uniform(name);
+        if (handle.entry < 0)
+            return;
+        GLuint current = GlState::get().program();
+        GlState::get().useProgram(ID);
+        set(handle, static_cast<int>(unit));
+        GlState::get().useProgram(current);
+    }
+
+    void addUniform(const std::string& name, GLint location, GLenum type)
+    {
+        if (location < 0)
+            return;
+        auto inserted = uniformEntries.emplace(uniformHash(name.c_str()), static_cast<int>(uniformSlots.size()));
+        if (!inserted.second)
+        {
+            std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION: " << name << std::endl;
+            return;
+        }
+        UniformSlot slot;
+        slot.location = location;
+        slot.type = type;
+        uniformSlots.push_back(slot);
+    }
+
+    // uploads a value remembered by another program for the same uniform, the program has to be in use
+    void restoreUniform(UniformSlot& slot, const unsigned char* value)
+    {
+        memcpy(slot.value, value, sizeof(slot.value));
+        slot.valid = true;
+        if (slot.type == GL_FLOAT)
+            glUniform1f(slot.location, *reinterpret_cast<const float*>(slot.value));
+        else if (slot.type == GL_FLOAT_VEC3)
+            glUniform3fv(slot.location, 1, reinterpret_cast<const float*>(slot.value));
+        else if (slot.type == GL_FLOAT_MAT3)
+            glUniformMatrix3fv(slot.location, 1, GL_FALSE, reinterpret_cast<const float*>(slot.value));
+        else if (slot.type == GL_FLOAT_MAT4)
+            glUniformMatrix4fv(slot.location, 1, GL_FALSE, reinterpret_cast<const float*>(slot.value));
+        else if (slot.type == GL_INT || slot.type == GL_BOOL || slot.type == GL_SAMPLER_2D || slot.type == GL_SAMPLER_CUBE
+            || slot.type == GL_SAMPLER_BUFFER || slot.type == GL_UNSIGNED_INT_SAMPLER_BUFFER)
+            glUniform1i(slot.location, *reinterpret_cast<const int*>(slot.value));
+        else
+            slot.valid = false; // a type the setters don't handle, nothing was set on the old program either
+    }
+
+    // compares with the last value of the uniform and remembers the new one. False for unknown uniforms.
+    bool changed(Uniform handle, const void* value, size_t bytes)
+    {
+        if (handle.entry < 0)
+            return false;
+        UniformSlot& slot = uniformSlots[handle.entry];
+        if (slot.valid && memcmp(slot.value, value, bytes) == 0)
+        {
+            skippedUploads++;
+            return false;
+        }
+        memcpy(slot.value, value, bytes);
+        slot.valid = true;
+        return true;
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(unsigned int shader, std::string type)
+    // returns whether it compiled/linked
+    bool checkCompileErrors(unsigned int shader, std::string type)
     {
         int success;
         char infoLog[1024];
@@ -139,6 +498,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
 };
 #endif
\ No newline at end of file
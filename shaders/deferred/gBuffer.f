@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) out vec4 gAlbedoOut;
+layout (location = 1) out vec2 gNormalOut;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+
+// Material Constants (the same as blinnPhong.f)
+const float MATERIAL_SHININESS = 32.0;
+
+#include "../include/localColor.glsl"
+#include "../include/gBuffer.glsl"
+
+uniform sampler2D texture_diffuse1;
+uniform bool useTexture; // Flag to enable/disable texture
+
+// the surface only, lighting happens in lighting.f
+void main()
+{
+    vec3 baseColor = useTexture ? texture(texture_diffuse1, TexCoords).rgb : localColor;
+    gAlbedoOut = vec4(baseColor, gBufferEncodeShininess(MATERIAL_SHININESS));
+    gNormalOut = gBufferEncodeNormal(normalize(Normal));
+}
\ No newline at end of file
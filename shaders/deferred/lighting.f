@@ -0,0 +1,65 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the G-buffer, put on their units when the program is linked
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection; // inverse(projection * view), set once per frame
+
+#include "../include/lights.glsl"
+#include "../include/camera.glsl"
+#include "../include/clusteredLights.glsl"
+#include "../include/gBuffer.glsl"
+
+// the lighting of blinnPhong.f, once per pixel instead of once per fragment drawn
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0)
+        discard; // nothing drawn here, the cleared background stays
+
+    vec4 albedoShininess = texelFetch(gAlbedo, pixel, 0);
+    vec3 baseColor = albedoShininess.rgb;
+    float shininess = gBufferDecodeShininess(albedoShininess.a);
+    vec3 norm = gBufferDecodeNormal(texelFetch(gNormal, pixel, 0).rg);
+    vec4 worldPosition = inverseViewProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    vec3 FragPos = worldPosition.xyz / worldPosition.w;
+
+    // --- 1. Attenuation calculation ---
+    float distance    = length(light.position - FragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance +
+                          light.quadratic * (distance * distance));
+
+    // --- 2. Lighting components ---
+    vec3 lightDir = normalize(light.position - FragPos);
+    vec3 ambient = light.ambient * baseColor * lightColor;
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diff * baseColor * lightColor;
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(norm, halfwayDir), 0.0), shininess);
+    vec3 specular = light.specular * spec * lightColor * 0.6;
+
+    // --- 3. Apply attenuation and combine results ---
+    vec3 result = (ambient + diffuse + specular) * attenuation;
+
+    // --- 4. Clustered point lights, only the ones that reach this pixel's cluster ---
+    uvec2 lightRange = clusterLightRange(gl_FragCoord.xy, -(view * vec4(FragPos, 1.0)).z);
+    for (uint i = lightRange.x; i < lightRange.x + lightRange.y; i++)
+    {
+        ClusterLight pointLight = clusterLight(i);
+        vec3 toLight = pointLight.position - FragPos;
+        float pointDistance = length(toLight);
+        vec3 pointDir = toLight / max(pointDistance, 1e-4);
+        float pointDiff = max(dot(norm, pointDir), 0.0);
+        float pointSpec = pow(max(dot(norm, normalize(pointDir + viewDir)), 0.0), shininess);
+        result += (pointDiff * baseColor + pointSpec * 0.6) * pointLight.color * clusterLightAttenuation(pointDistance, pointLight.radius);
+    }
+
+    FragColor = vec4(result, 1.0);
+}
\ No newline at end of file
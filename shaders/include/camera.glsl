@@ -0,0 +1,7 @@
+// per-frame camera data shared by all programs (CameraBlock in uniformBlocks.h)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
@@ -0,0 +1,48 @@
+// point lights binned into view space clusters on the CPU (LightClusters in clusteredLighting.h, ClusterBlock in
+// uniformBlocks.h). The samplers are put on their units when the program is linked.
+layout (std140) uniform Clusters
+{
+    ivec4 clusterGrid;  // tiles x, tiles y, depth slices, light count
+    vec4 clusterScale;  // tiles per pixel x and y, depth slice scale and bias
+};
+uniform samplerBuffer clusterLights;        // two texels per light: position and radius, color
+uniform usamplerBuffer clusterRanges;       // first index and light count of each cluster
+uniform usamplerBuffer clusterLightIndices; // the lights of each cluster
+
+struct ClusterLight {
+    vec3 position;
+    float radius;
+    vec3 color;
+};
+
+// the first index and the count of the lights of the cluster a fragment is in, viewDepth is its distance along the
+// view direction
+uvec2 clusterLightRange(vec2 fragCoord, float viewDepth)
+{
+    if (clusterGrid.w == 0)
+        return uvec2(0u);
+    vec3 cell = vec3(fragCoord * clusterScale.xy, log(max(viewDepth, 1e-4)) * clusterScale.z + clusterScale.w);
+    ivec3 clamped = clamp(ivec3(floor(cell)), ivec3(0), clusterGrid.xyz - 1);
+    int cluster = (clamped.z * clusterGrid.y + clamped.y) * clusterGrid.x + clamped.x;
+    return texelFetch(clusterRanges, cluster).xy;
+}
+
+// light i of a range from clusterLightRange
+ClusterLight clusterLight(uint i)
+{
+    int index = int(texelFetch(clusterLightIndices, int(i)).r);
+    vec4 positionRadius = texelFetch(clusterLights, 2 * index);
+    ClusterLight light;
+    light.position = positionRadius.xyz;
+    light.radius = positionRadius.w;
+    light.color = texelFetch(clusterLights, 2 * index + 1).rgb;
+    return light;
+}
+
+// inverse square falloff that is windowed down to 0 at the radius, so the light ends where its cluster tests end
+float clusterLightAttenuation(float distance, float radius)
+{
+    float ratio = distance / radius;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return window * window / (1.0 + 16.0 * ratio * ratio);
+}
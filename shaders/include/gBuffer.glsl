@@ -0,0 +1,29 @@
+// packing of the G-buffer targets (GBuffer in deferredShading.h): albedo and shininess in RGBA8, the normal in RG16
+
+// octahedral encoding into [0, 1], the inverse of the decode in model.v
+vec2 gBufferEncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+vec3 gBufferDecodeNormal(vec2 encoded)
+{
+    vec2 e = encoded * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+// shininess 1 to 256 on a log scale, so the 8 bits are spread evenly over the visible range
+float gBufferEncodeShininess(float shininess)
+{
+    return log2(shininess) / 8.0;
+}
+
+float gBufferDecodeShininess(float encoded)
+{
+    return exp2(encoded * 8.0);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+struct Light {
+    vec3 position;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+// scene light shared by all programs (LightBlock in uniformBlocks.h)
+layout (std140) uniform Lights
+{
+    Light light;
+    vec3 lightColor;
+};
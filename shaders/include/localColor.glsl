@@ -0,0 +1,7 @@
+// the model color: a uniform, or per instance from model.v when the shader is built with INSTANCED
+#ifdef INSTANCED
+in vec3 InstanceColor;
+#define localColor InstanceColor
+#else
+uniform vec3 localColor;
+#endif
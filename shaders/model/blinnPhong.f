@@ -16,9 +16,7 @@ const float LIGHT_QUADRATIC = 0.032;
 // Material Constants
 const float MATERIAL_SHININESS = 32.0;
 
-uniform vec3 viewPos;
-uniform vec3 localColor;
-uniform vec3 lightColor;
+#include "../include/localColor.glsl"
 
 uniform sampler2D texture_diffuse1;
 uniform bool useTexture; // Flag to enable/disable texture
@@ -31,18 +29,9 @@ struct Material {
 };
 uniform Material material;
 
-struct Light {
-    vec3 position;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-uniform Light light;
+#include "../include/lights.glsl"
+#include "../include/camera.glsl"
+#include "../include/clusteredLights.glsl"
 
 void main()
 {
@@ -83,6 +72,19 @@ void main()
 
     vec3 result = ambient + diffuse + specular;
 
+    // --- 4. Clustered point lights, only the ones that reach this fragment's cluster ---
+    uvec2 lightRange = clusterLightRange(gl_FragCoord.xy, -(view * vec4(FragPos, 1.0)).z);
+    for (uint i = lightRange.x; i < lightRange.x + lightRange.y; i++)
+    {
+        ClusterLight pointLight = clusterLight(i);
+        vec3 toLight = pointLight.position - FragPos;
+        float pointDistance = length(toLight);
+        vec3 pointDir = toLight / max(pointDistance, 1e-4);
+        float pointDiff = max(dot(norm, pointDir), 0.0);
+        float pointSpec = pow(max(dot(norm, normalize(pointDir + viewDir)), 0.0), MATERIAL_SHININESS);
+        result += (pointDiff * baseColor + pointSpec * 0.6) * pointLight.color * clusterLightAttenuation(pointDistance, pointLight.radius);
+    }
+
     // Output the final color
     FragColor = vec4(result, 1.0);
 }
\ No newline at end of file
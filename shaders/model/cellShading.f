@@ -16,16 +16,16 @@ const float LIGHT_QUADRATIC = 0.032;
 // Material Constants
 const float MATERIAL_SHININESS = 32.0;
 
-uniform vec3 localColor;
-uniform vec3 lightColor; 
+#include "../include/localColor.glsl"
 
 // Cell Shading Constants
-const int SHADING_LEVELS = 3; // Number of discrete shading levels
+// Number of discrete shading levels, a compile-time define so the UI can build variants
+#ifndef SHADING_LEVELS
+#define SHADING_LEVELS 3
+#endif
 const float SPECULAR_THRESHOLD = 0.8; // Threshold for specular highlight
 const float EDGE_THRESHOLD = 0.2; // Threshold for edge detection
 
-uniform vec3 viewPos;
-
 struct Material {
     sampler2D diffuse;
     sampler2D specular;
@@ -34,18 +34,9 @@ struct Material {
 };
 uniform Material material;
 
-struct Light {
-    vec3 position;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-uniform Light light;
+#include "../include/lights.glsl"
+#include "../include/camera.glsl"
+#include "../include/clusteredLights.glsl"
 
 void main()
 {
@@ -93,6 +84,19 @@ void main()
 
     vec3 result = ambient + diffuse + specular + rimColor;
 
+    // --- 6. Clustered point lights, quantized the same way ---
+    uvec2 lightRange = clusterLightRange(gl_FragCoord.xy, -(view * vec4(FragPos, 1.0)).z);
+    for (uint i = lightRange.x; i < lightRange.x + lightRange.y; i++)
+    {
+        ClusterLight pointLight = clusterLight(i);
+        vec3 toLight = pointLight.position - FragPos;
+        float pointDistance = length(toLight);
+        vec3 pointDir = toLight / max(pointDistance, 1e-4);
+        float pointDiffuse = floor(max(dot(norm, pointDir), 0.0) / levelSize) * levelSize;
+        float pointSpecular = step(SPECULAR_THRESHOLD, pow(max(dot(norm, normalize(pointDir + viewDir)), 0.0), MATERIAL_SHININESS));
+        result += (pointDiffuse * localColor + pointSpecular) * pointLight.color * clusterLightAttenuation(pointDistance, pointLight.radius);
+    }
+
     // Output the final color
     FragColor = vec4(result, 1.0);
 }
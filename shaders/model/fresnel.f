@@ -6,9 +6,10 @@ in vec3 Normal;
 in vec3 FragPos;
 
 uniform sampler2D texture_diffuse1;
-uniform vec3 viewPos;
-uniform vec3 localColor;
-uniform vec3 lightColor;
+#include "../include/localColor.glsl"
+
+#include "../include/lights.glsl"
+#include "../include/camera.glsl"
 
 const float R0 = 0.04; // Base reflectivity for non-metals
 
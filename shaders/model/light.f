@@ -4,8 +4,7 @@ out vec4 FragColor;
 in vec2 TexCoords;
 in vec3 Normal;
 
-uniform vec3 lightColor;
-uniform vec3 viewPos;
+#include "../include/lights.glsl"
 
 void main()
 {   
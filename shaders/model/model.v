@@ -1,6 +1,6 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 0) in vec3 aPos;    // packed meshes: unorm16 position in [0, 1] of the mesh bounds
+layout (location = 1) in vec3 aNormal;  // packed meshes: octahedral normal in xy
 layout (location = 2) in vec2 aTexCoords;
 
 out vec2 TexCoords;
@@ -8,13 +8,43 @@ out vec3 Normal;
 out vec3 FragPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix; // transpose(inverse(mat3(model))), computed on the CPU once per object
+#ifdef INSTANCED
+// per-instance model matrix and color from an InstanceBuffer (instancing.h). model and normalMatrix are the rest pose
+// of the mesh's node inside the model then, applied before the instance's.
+layout (location = 7) in mat4 aInstanceModel;
+layout (location = 11) in vec3 aInstanceColor;
+layout (location = 12) in mat3 aInstanceNormalMatrix;
+out vec3 InstanceColor;
+#endif
+#include "../include/camera.glsl"
+
+// vertex decode, set by Mesh::Draw. The defaults leave full float vertices untouched.
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
+uniform bool octahedralNormals = false;
+
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
+    vec3 position = positionOffset + aPos * positionScale;
+    vec3 normal = octahedralNormals ? octahedralDecode(aNormal.xy) : aNormal;
     TexCoords = aTexCoords;
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-	Normal = mat3(transpose(inverse(model))) * aNormal;
+#ifdef INSTANCED
+    InstanceColor = aInstanceColor;
+    vec4 worldPosition = aInstanceModel * (model * vec4(position, 1.0));
+	Normal = aInstanceNormalMatrix * (normalMatrix * normal);
+#else
+    vec4 worldPosition = model * vec4(position, 1.0);
+	Normal = normalMatrix * normal;
+#endif
+    FragPos = vec3(worldPosition);
+    gl_Position = projection * view * worldPosition;
 }
\ No newline at end of file
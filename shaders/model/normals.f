@@ -5,7 +5,6 @@ in vec2 TexCoords;
 in vec3 Normal;
 
 uniform sampler2D texture_diffuse1;
-uniform vec3 viewPos;
 
 void main()
 {   
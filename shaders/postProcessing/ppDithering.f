@@ -5,8 +5,13 @@ in vec2 TexCoords;
 uniform sampler2D screenTexture;
 
 // Configurable constants - adjust these as needed
-const float DITHER_SIZE = 2.0;      // Pixelation amount (1.0 = no pixelation)
-const float BIT_DEPTH = 4.0;        // Number of gray levels (2, 4, 8, 16, etc.)
+// DITHER_SIZE and BIT_DEPTH are compile-time defines so the UI can build variants
+#ifndef DITHER_SIZE
+#define DITHER_SIZE 2.0             // Pixelation amount (1.0 = no pixelation)
+#endif
+#ifndef BIT_DEPTH
+#define BIT_DEPTH 4.0               // Number of gray levels (2, 4, 8, 16, etc.)
+#endif
 const float CONTRAST = 1.0;         // Contrast adjustment (1.0 = normal)
 const float OFFSET = 0.0;           // Brightness offset (-0.5 to 0.5)
 
@@ -17,7 +17,10 @@ const float kernel[9] = float[](
     1.0, 2.0, 1.0
 );
 const float kernel_sum = 16.0;
-const float BLUR_STRENGTH = 5.0; // Increase this for stronger blur
+// Increase this for stronger blur (compile-time define, see shaderPreprocessor.h)
+#ifndef BLUR_STRENGTH
+#define BLUR_STRENGTH 5.0
+#endif
 
 void main()
 {
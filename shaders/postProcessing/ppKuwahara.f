@@ -5,8 +5,11 @@ in vec2 TexCoords;
 
 uniform sampler2D screenTexture;
 
-// The radius for the filter. Kuwahara uses a 5x5 window, so radius is 2.
-const int RADIUS = 2;
+// The radius for the filter. The classic Kuwahara uses a 5x5 window, so radius is 2. A compile-time define so the
+// sample loops below unroll for every variant the UI builds.
+#ifndef RADIUS
+#define RADIUS 2
+#endif
 
 // Structure to hold the mean and variance for one of the four quadrants
 struct Quadrant
@@ -31,41 +34,37 @@ void main()
 {
     vec2 texelSize = 1.0 / textureSize(screenTexture, 0);
 
-    // The four quadrants are defined by their top-left corner relative to the center pixel.
+    // The four quadrants are the (RADIUS+1)x(RADIUS+1) regions that share the center pixel as a corner.
     // The standard 5x5 filter uses four overlapping 3x3 regions.
-    // The offset of the starting sample in TexCoords space:
-    vec2 half_offset = texelSize * float(RADIUS);
 
     // Initialize the best result found so far
     Quadrant best = Quadrant(vec3(0.0), 10000.0); // Variance initialized to a very high number
 
-    // Define the 4 quadrant starting points relative to the center pixel:
-    // Q1: Top-Left (from -2,-2 to 0,0) - shifted back by -1,-1
-    // Q2: Top-Right (from 0,-2 to 2,0) - shifted back by 1,-1
-    // Q3: Bottom-Left (from -2,0 to 0,2) - shifted back by -1,1
-    // Q4: Bottom-Right (from 0,0 to 2,2) - shifted back by 1,1
+    // Define the 4 quadrants relative to the center pixel (for RADIUS 2):
+    // Q1: Top-Left (from -2,-2 to 0,0)
+    // Q2: Top-Right (from 0,-2 to 2,0)
+    // Q3: Bottom-Left (from -2,0 to 0,2)
+    // Q4: Bottom-Right (from 0,0 to 2,2)
     
-    // Loop through the 4 quadrants (represented by the sign of the starting sample position)
+    // Loop through the 4 quadrants (represented by the direction they extend in from the center)
     for (int i = 0; i < 4; ++i)
     {
-        // Calculate the starting offset for the 3x3 region
-        // This setup samples an area offset by (+/-1, +/-1) from the center
         float x_sign = (i % 2 == 0) ? -1.0 : 1.0;
         float y_sign = (i < 2) ? -1.0 : 1.0;
         
-        vec2 startOffset = vec2(x_sign, y_sign) * texelSize;
+        vec2 direction = vec2(x_sign, y_sign) * texelSize;
         
         vec3 sum = vec3(0.0);
         vec3 sum_sq = vec3(0.0);
         float count = 0.0;
         
-        // Loop through the 3x3 region (from -1 to 1) relative to the startOffset
-        for (int x = -1; x <= 1; ++x)
+        // Loop through the region (from 0 to RADIUS away from the center in both directions)
+        for (int x = 0; x <= RADIUS; ++x)
         {
-            for (int y = -1; y <= 1; ++y)
+            for (int y = 0; y <= RADIUS; ++y)
             {
                 // Calculate the final sample coordinate
-                vec2 currentOffset = startOffset + vec2(x, y) * texelSize;
+                vec2 currentOffset = vec2(x, y) * direction;
                 vec3 color = texture(screenTexture, TexCoords + currentOffset).rgb;
                 
                 // Accumulate sum and sum of squares for variance calculation
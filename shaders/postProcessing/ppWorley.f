@@ -5,8 +5,10 @@ in vec2 TexCoords;
 
 // The image to be crystallized (required for filtering the image)
 uniform sampler2D screenTexture; 
-// Uniform to control the scale/density of the noise cells
-const float scale = 70.0; // Increased scale for finer crystals
+// Scale/density of the noise cells, a compile-time define so the UI can build variants
+#ifndef SCALE
+#define SCALE 70.0 // Increased scale for finer crystals
+#endif
 uniform float time = 0.0; // Optional for animation
 
 // Hashing function to generate deterministic pseudo-random 2D vectors (offsets)
@@ -20,7 +22,7 @@ vec2 hash22(vec2 p)
 void main()
 {
     // 1. Scale coordinates
-    vec2 p = TexCoords * scale; // p is in scaled coordinate space (e.g., 0 to 20)
+    vec2 p = TexCoords * SCALE; // p is in scaled coordinate space (e.g., 0 to 20)
 
     // 2. Find the integer coordinates of the current cell
     vec2 cell = floor(p);
@@ -58,7 +60,7 @@ void main()
     
     // --- 5. Image Crystallization Sampling ---
     // a. Convert the closest feature point location back to normalized UV coordinates (0.0 to 1.0)
-    vec2 sampleUV = closestFeaturePoint_p / scale;
+    vec2 sampleUV = closestFeaturePoint_p / SCALE;
     
     // b. Sample the original image at this calculated point
     vec4 finalColor = texture(screenTexture, sampleUV);
@@ -1,6 +1,6 @@
 #version 330 core
 layout (location = 0) in vec2 aPos;
-layout (location = 1) in vec2 aTexCoords;
+layout (location = 2) in vec2 aTexCoords; // location 1 holds normals in the shared Vertex layout
 
 out vec2 TexCoords;
 
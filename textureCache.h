@@ -0,0 +1,281 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include "glState.h"
+#include "stb_image.h"
+#include "threadPool.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// decoded image waiting to be uploaded. Owns the stb_image allocation.
+struct ImageData
+{
+    int width = 0;
+    int height = 0;
+    int nrComponents = 0;
+    float decodeMs = 0.0f; // time stb_image took, for the load report
+    std::unique_ptr<unsigned char, void (*)(void*)> pixels{ nullptr, stbi_image_free };
+};
+
+ImageData decodeImage(const std::string& filename);
+unsigned int uploadTexture(const ImageData& image, bool gamma = false);
+
+// Process-wide registry of 2D textures, keyed by resolved file path and load flags. Every image is decoded and uploaded once
+// no matter how many models reference it, and its GL texture is deleted when the last reference is released.
+// acquire/release must be called on the GL thread, isLoaded may be called from any thread.
+class TextureCache
+{
+public:
+    // load flags that produce a different GL texture for the same file
+    enum Flags : uint32_t
+    {
+        GAMMA = 1 << 0, // sRGB internal format
+    };
+
+    static TextureCache& get()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // returns the texture for a file and takes a reference to it. Uploads the image on first use, decoding it here
+    // unless the caller already did (e.g. on a worker thread).
+    unsigned int acquire(const std::string& path, bool gamma = false, const ImageData* decoded = nullptr)
+    {
+        Key key{ resolve(path), gamma ? GAMMA : 0u };
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            it->second.references++;
+            return it->second.id;
+        }
+
+        ImageData image;
+        if (!decoded)
+        {
+            image = decodeImage(path);
+            decoded = &image;
+        }
+        auto uploadStart = std::chrono::steady_clock::now();
+        Entry entry;
+        entry.id = uploadTexture(*decoded, gamma);
+        entry.bytes = textureBytes(*decoded);
+        entry.references = 1;
+        float uploadMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - uploadStart).count();
+        loadLog.push_back({ key.path, decoded->width, decoded->height, decoded->nrComponents, decoded->decodeMs, uploadMs });
+        residentBytes += entry.bytes;
+        keysById[entry.id] = key;
+        entries.emplace(std::move(key), entry);
+        return entry.id;
+    }
+
+    // drops a reference taken by acquire, deleting the GL texture with the last one
+    void release(unsigned int id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto key = keysById.find(id);
+        if (key == keysById.end())
+            return;
+        auto it = entries.find(key->second);
+        if (--it->second.references > 0)
+            return;
+        GlState::get().forgetTexture(id);
+        glDeleteTextures(1, &id);
+        residentBytes -= it->second.bytes;
+        entries.erase(it);
+        keysById.erase(key);
+    }
+
+    // whether a texture for this file is resident, used by loaders to skip decoding images that are already uploaded
+    bool isLoaded(const std::string& path, bool gamma = false)
+    {
+        Key key{ resolve(path), gamma ? GAMMA : 0u };
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.count(key) != 0;
+    }
+
+    // prints decode and upload time of every texture loaded since the last report, then clears the log
+    void printLoadReport()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        float decodeTotal = 0.0f, uploadTotal = 0.0f;
+        std::cout << "Texture load report:" << std::endl;
+        for (const LoadRecord& record : loadLog)
+        {
+            char line[512];
+            snprintf(line, sizeof(line), "  %-40s %5dx%-5d x%d  decode %7.2f ms  upload %7.2f ms",
+                record.path.c_str(), record.width, record.height, record.nrComponents, record.decodeMs, record.uploadMs);
+            std::cout << line << std::endl;
+            decodeTotal += record.decodeMs;
+            uploadTotal += record.uploadMs;
+        }
+        char line[256];
+        snprintf(line, sizeof(line), "  %d textures: decode %.2f ms (summed over all threads), upload %.2f ms", (int)loadLog.size(), decodeTotal, uploadTotal);
+        std::cout << line << std::endl;
+        loadLog.clear();
+    }
+
+    size_t textureCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    // estimated VRAM held by resident textures, including mipmaps
+    size_t bytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return residentBytes;
+    }
+
+private:
+    struct Key
+    {
+        std::string path;
+        uint32_t flags;
+        bool operator==(const Key& other) const { return flags == other.flags && path == other.path; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const { return std::hash<std::string>()(key.path) ^ (size_t(key.flags) * 0x9E3779B97F4A7C15ull); }
+    };
+
+    struct Entry
+    {
+        unsigned int id = 0;
+        unsigned int references = 0;
+        size_t bytes = 0;
+    };
+
+    struct LoadRecord
+    {
+        std::string path;
+        int width, height, nrComponents;
+        float decodeMs, uploadMs;
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    std::unordered_map<unsigned int, Key> keysById;
+    std::mutex mutex;
+    size_t residentBytes = 0;
+    std::vector<LoadRecord> loadLog;
+
+    TextureCache() {}
+
+    // different spellings of the same file ("a/./b.png", "a\\b.png") share one entry
+    static std::string resolve(const std::string& path)
+    {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+    static size_t textureBytes(const ImageData& image)
+    {
+        // a full mip chain adds a third on top of the base level
+        return image.pixels ? size_t(image.width) * image.height * image.nrComponents * 4 / 3 : 0;
+    }
+};
+
+// Loads a set of textures together: the images are decoded in parallel on the thread pool, then uploaded through the
+// TextureCache on the GL thread in one go. Files that are already resident are not decoded again.
+class TextureBatch
+{
+public:
+    explicit TextureBatch(ThreadPool& pool) : pool(pool) {}
+
+    void add(const std::string& path, bool gamma = false)
+    {
+        requests.push_back({ path, gamma });
+    }
+
+    // decodes and uploads everything added so far, returns one referenced texture id per add() call, in order
+    std::vector<unsigned int> load()
+    {
+        std::vector<ImageData> images(requests.size());
+        std::vector<bool> decoded(requests.size());
+        for (size_t i = 0; i < requests.size(); i++)
+            decoded[i] = !TextureCache::get().isLoaded(requests[i].path, requests[i].gamma);
+        pool.parallelFor(requests.size(), [&](size_t i)
+        {
+            if (decoded[i])
+                images[i] = decodeImage(requests[i].path);
+        });
+
+        std::vector<unsigned int> ids;
+        for (size_t i = 0; i < requests.size(); i++)
+            ids.push_back(TextureCache::get().acquire(requests[i].path, requests[i].gamma, decoded[i] ? &images[i] : nullptr));
+        requests.clear();
+        return ids;
+    }
+
+private:
+    struct Request
+    {
+        std::string path;
+        bool gamma;
+    };
+
+    ThreadPool& pool;
+    std::vector<Request> requests;
+};
+
+
+// decodes an image file with stb_image. Thread-safe, so it can run off the GL thread.
+ImageData decodeImage(const std::string& filename)
+{
+    auto start = std::chrono::steady_clock::now();
+    ImageData image;
+    image.pixels.reset(stbi_load(filename.c_str(), &image.width, &image.height, &image.nrComponents, 0));
+    image.decodeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (!image.pixels)
+        std::cout << "Texture failed to load at path: " << filename << std::endl;
+    return image;
+}
+
+// creates a mipmapped 2D texture from a decoded image. An empty image still yields a (blank) texture id.
+unsigned int uploadTexture(const ImageData& image, bool gamma)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    if (image.pixels)
+    {
+        GLenum format = GL_RGB;
+        if (image.nrComponents == 1)
+            format = GL_RED;
+        else if (image.nrComponents == 3)
+            format = GL_RGB;
+        else if (image.nrComponents == 4)
+            format = GL_RGBA;
+        GLenum internalFormat = format;
+        if (gamma && format == GL_RGB)
+            internalFormat = GL_SRGB;
+        else if (gamma && format == GL_RGBA)
+            internalFormat = GL_SRGB_ALPHA;
+
+        GlState::get().bindTexture(0, GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.get());
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    return textureID;
+}
+#endif
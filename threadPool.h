@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for jobs that must stay off the render thread (model loading, image decoding).
+// Jobs must not make GL calls, the context is only current on the main thread.
+class ThreadPool
+{
+public:
+    // 0 threads means one per hardware thread, minus the one the render loop runs on
+    explicit ThreadPool(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            unsigned int hardwareThreads = std::thread::hardware_concurrency(); // 0 when it can't be determined
+            threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    // finishes the queued jobs, then joins the workers
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // runs body(i) for every i in [0, count) across the workers and the calling thread, and returns once all are done.
+    // The caller claims items as well, so this is safe to call from inside a pool job even when every worker is busy.
+    void parallelFor(size_t count, std::function<void(size_t)> body)
+    {
+        if (count == 0)
+            return;
+        struct Batch
+        {
+            std::atomic<size_t> next{ 0 };
+            size_t count = 0;
+            size_t done = 0;
+            std::function<void(size_t)> body;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto batch = std::make_shared<Batch>();
+        batch->count = count;
+        batch->body = std::move(body);
+
+        // helpers that only start once all items are claimed find nothing to do and never touch body
+        auto run = [batch]
+        {
+            size_t completed = 0;
+            for (size_t i = batch->next++; i < batch->count; i = batch->next++)
+            {
+                batch->body(i);
+                completed++;
+            }
+            if (completed == 0)
+                return;
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->done += completed;
+            if (batch->done == batch->count)
+                batch->finished.notify_all();
+        };
+        size_t helpers = std::min<size_t>(workers.size(), count - 1);
+        for (size_t i = 0; i < helpers; i++)
+            submit(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->finished.wait(lock, [&batch] { return batch->done == batch->count; });
+    }
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+#endif
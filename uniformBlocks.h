@@ -0,0 +1,95 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader_s.h"
+
+// C++ mirrors of the std140 uniform blocks the shaders share. Every vec3 starts on a 16 byte boundary; a float may
+// fill the rest of the slot after a vec3, which is what std140 does as well. Keep these in sync with the GLSL.
+
+// layout (std140) uniform Camera, updated once per frame
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    float padding0;
+};
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 layout of the Camera block");
+
+// layout (std140) uniform Lights, updated when the light settings change
+struct LightBlock
+{
+    // struct Light light
+    glm::vec3 position;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+    float padding3[2]; // std140 rounds the struct up to 16 bytes
+    // vec3 lightColor
+    glm::vec3 color;
+    float padding4;
+};
+static_assert(sizeof(LightBlock) == 96, "LightBlock must match the std140 layout of the Lights block");
+
+// layout (std140) uniform Clusters, updated every frame from LightClusters (clusteredLighting.h)
+struct ClusterBlock
+{
+    glm::ivec4 grid;  // tiles x, tiles y, depth slices, light count (0 turns the clustered lights off)
+    glm::vec4 scale;  // tiles per pixel x and y, depth slice scale and bias
+};
+static_assert(sizeof(ClusterBlock) == 32, "ClusterBlock must match the std140 layout of the Clusters block");
+
+// a uniform buffer object attached to one of the UniformBlockBinding points, so every program sees it without per-program uploads
+template <typename Block>
+class UniformBuffer
+{
+public:
+    explicit UniformBuffer(UniformBlockBinding binding) : binding(binding) {}
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    // must run on the GL thread
+    void create()
+    {
+        glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, UBO);
+    }
+
+    void release()
+    {
+        glDeleteBuffers(1, &UBO);
+        UBO = 0;
+    }
+
+    // uploads the block unless it is the same as last time
+    void update(const Block& block)
+    {
+        if (uploaded && memcmp(&block, &current, sizeof(Block)) == 0)
+            return;
+        current = block;
+        uploaded = true;
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &current);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+private:
+    UniformBlockBinding binding;
+    unsigned int UBO = 0;
+    Block current = {};
+    bool uploaded = false;
+};
+#endif